@@ -0,0 +1,59 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <gb.h>
+
+#define BATCH_DEFAULT_QUANTUM 60   // frames an instance runs before going back to the scheduler
+
+// joypad state from a given frame on
+typedef struct batch_input {
+    uint32_t frame;
+    uint8_t buttons;    // GB_BUTTON_* bits
+} batch_input;
+
+// one instance to run, the caller fills in the first part and gb_batch_run the results
+typedef struct gb_batch_job {
+    const char *rom_path;
+    const batch_input *inputs;  // sorted by frame, NULL to press nothing
+    uint32_t input_count;
+    uint32_t frames;
+    const uint8_t *start_state; // save state to start from instead of power on, NULL for none
+    size_t start_state_size;
+
+    // results
+    uint32_t frames_run;
+    uint64_t cycles;
+    double seconds;             // time spent running this instance, summed over workers
+    uint64_t screen_hash;       // fnv-1a of the last frame's palette indices
+    int error;                  // -1 if the rom or start state couldn't be loaded
+
+    // scheduler state
+    const gb *boot;             // the rom loaded at power on, shared by every job running it
+    gb *gb;
+    uint32_t next_input;
+} gb_batch_job;
+
+typedef struct gb_batch_options {
+    int threads;                // 0 for one per online cpu
+    uint32_t quantum;           // 0 for BATCH_DEFAULT_QUANTUM
+    bool pin_threads;           // pin worker i to cpu i
+} gb_batch_options;
+
+typedef struct gb_batch_stats {
+    int threads;
+    uint64_t frames;
+    double seconds;             // wall clock
+    uint64_t steals;            // tasks run by a worker other than the one that queued them
+} gb_batch_stats;
+
+// run every job to completion on a pool of worker threads
+// returns 0, or -1 if the workers couldn't be started
+int gb_batch_run(gb_batch_job *jobs, int count, const gb_batch_options *options, gb_batch_stats *stats);
+
+// read an input script: one "frame buttons" pair per line, buttons as GB_BUTTON_* hex,
+// # starts a comment. returns the number of entries or -1, *inputs is malloc'd
+int batch_load_inputs(const char *path, batch_input **inputs);
+
+#endif
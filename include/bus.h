@@ -3,6 +3,20 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+
+struct ppu;
+
+// a byte on the serial port takes 8 bits at 8192 Hz on the internal clock
+#define SERIAL_TRANSFER_CYCLES 4096
+
+// rom image, read only once loaded and shared by every clone of a machine
+// freed when the last bus using it lets go
+typedef struct bus_rom {
+    uint32_t refs;
+    size_t size;
+    uint8_t data[];
+} bus_rom;
 
 typedef struct bus {
     uint8_t *memory;
@@ -11,7 +25,8 @@ typedef struct bus {
     uint8_t joypad_select; // select bits
     
     // mbc (only no mbc and mbc3 handled)
-    uint8_t *rom_data;    // full ROM data
+    uint8_t *rom_data;    // full ROM data, rom->data
+    bus_rom *rom;
     uint8_t mbc_type;     // 0=none, 1=mbc1, 2=mbc2, 3=mbc3 etc
     uint8_t rom_bank;     // current ROM bank
     uint8_t ram_bank;     // current RAM bank
@@ -19,6 +34,18 @@ typedef struct bus {
 
     // no rtc for mb3 
 
+    // ppu to notify of video writes, NULL until ppu_init
+    struct ppu *ppu;
+    uint32_t vram_dirty;  // 256 byte vram pages written since the ppu last snapshotted
+    bool oam_dirty;       // oam written (directly or by dma) since then
+    uint64_t page_dirty[2];  // 256 byte pages of 0x8000-0xFFFF written since gb_state_hash last ran
+
+    // serial port
+    uint16_t serial_cycles;  // t-cycles left in a transfer on our own clock, 0 when idle
+    bool serial_due;         // that transfer has finished, waiting for the link to exchange bytes
+    bool serial_linked;      // a link cable is plugged in, see link.h
+
+
 } bus;
 
 void bus_init(bus *bus);
@@ -28,11 +55,18 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value);
 uint16_t bus_read16(bus *bus, uint16_t address);
 void bus_write16(bus *bus, uint16_t address, uint16_t value);
 void bus_increment_div(bus *bus);
+uint8_t bus_joypad_lines(bus *bus);
+void bus_joypad_changed(bus *bus, uint8_t old_lines);
+void bus_set_joypad(bus *bus, uint8_t dpad_state, uint8_t button_state);
+void bus_serial_tick(bus *bus, uint32_t cycles);
+void bus_serial_complete(bus *bus, uint8_t received);
 // uint8_t bus_read_interrupt_register(bus *bus, uint16_t address);
 // void bus_write_interrupt_register(bus *bus, uint16_t address, uint8_t value);
 // uint8_t bus_read_timer_register(bus *bus, uint16_t address);
 // void bus_write_timer_register(bus *bus, uint16_t address, uint8_t value);
 int load_rom(bus *bus, const char *rom_path);
+void bus_share_rom(bus *bus, bus_rom *rom);
+void bus_release_rom(bus *bus);
 void print_bits(uint8_t value, const char *name);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef GB_H
+#define GB_H
+
+#include <stdint.h>
+#include <cpu.h>
+#include <ppu.h>
+
+#define GB_CYCLES_PER_FRAME 70224   // 154 lines * 456 dots
+
+// joypad buttons for gb_set_joypad, set bits are held down
+#define GB_BUTTON_RIGHT  0x01
+#define GB_BUTTON_LEFT   0x02
+#define GB_BUTTON_UP     0x04
+#define GB_BUTTON_DOWN   0x08
+#define GB_BUTTON_A      0x10
+#define GB_BUTTON_B      0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START  0x80
+
+// joypad changes from another thread, applied by the emulation thread at set cycles
+// single producer, single consumer, lock free
+#define GB_INPUT_QUEUE_SIZE 64
+
+// 0x8000-0xFFFF in 256 byte pages, for gb_state_hash
+#define GB_HASH_PAGES 128
+
+struct gb;
+
+typedef struct gb_input_event {
+    uint32_t cycle;     // applied before the first instruction at or after this cpu count
+    uint8_t buttons;    // GB_BUTTON_* bits
+} gb_input_event;
+
+typedef struct gb_input_queue {
+    gb_input_event events[GB_INPUT_QUEUE_SIZE];
+    uint32_t head;      // written by the producer
+    uint32_t tail;      // written by the emulation thread
+    uint32_t next;      // next event to apply, runs past tail while running ahead
+    bool ahead;         // running ahead (gb_run_frame_ahead): events are taken but their
+                        // slots kept, applied isn't called and clock isn't moved
+    uint32_t clock;     // cpu count when the last real run call returned, for the producer
+
+    // called on the emulation thread after a queued change is applied (movie recording)
+    void (*applied)(void *user, struct gb *gb);
+    void *user;
+} gb_input_queue;
+
+// one emulated machine, the cpu owns the bus and points at the ppu
+// must not move once gb_init has run (the bus and cpu keep pointers into it)
+//
+// instances share nothing mutable: all state lives in the gb and its own allocations,
+// the only statics in the core are const tables, and every callback gets the user pointer
+// it was registered with. so any number of instances can run on different threads at once,
+// as long as each one is only driven from one thread at a time (plus its own render thread)
+typedef struct gb {
+    cpu cpu;
+    ppu ppu;
+    gb_input_queue input;
+    uint64_t page_hashes[GB_HASH_PAGES];  // as of the last gb_state_hash
+} gb;
+
+// heap allocated machine for library users, NULL if out of memory
+gb *gb_create(void);
+void gb_destroy(gb *gb);
+int gb_load_rom(gb *gb, const char *rom_path);
+
+// independent copy of a running machine, for branching searches. the rom is shared (it
+// never changes), everything else is copied through a save state. the copy starts with no
+// output sink, observation or render thread, and picks up drawing with a fresh snapshot.
+// NULL if out of memory
+gb *gb_clone(const gb *gb);
+
+// the same into an existing machine, reusing its allocations. returns 0 or -1
+int gb_copy(gb *dst, const gb *src);
+
+// for embedding a gb in another struct
+void gb_init(gb *gb);
+void gb_free(gb *gb);
+
+// set which buttons are held, GB_BUTTON_* bits
+// leaves the select bits alone, those belong to the game. a newly pressed key in a selected
+// group requests the joypad interrupt, which also wakes a halted cpu
+void gb_set_joypad(gb *gb, uint8_t buttons);
+
+// queue a joypad change from another thread, applied once the cpu count reaches cycle
+// (gb_input_clock for as soon as possible). events are applied in order, between
+// instructions, by gb_step, gb_run_cycles and gb_run_frame. returns false if the queue is full
+bool gb_input_push(gb *gb, uint32_t cycle, uint8_t buttons);
+
+// cpu count as of the last run call, never one run ahead. safe to read from the producer
+// thread
+uint32_t gb_input_clock(const gb *gb);
+
+// one instruction (or interrupt dispatch), for callers with their own run loop
+void gb_step(gb *gb);
+
+// run at least the given number of t-cycles, returns how many actually ran
+// (instructions aren't split so it can overshoot by one instruction)
+uint32_t gb_run_cycles(gb *gb, uint32_t cycles);
+
+// run until the next vblank starts, or for one frame's worth of cycles while the lcd is off
+// returns the t-cycles that ran
+uint32_t gb_run_frame(gb *gb);
+
+#endif
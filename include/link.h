@@ -0,0 +1,32 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <gb.h>
+
+// link cable between two machines in one process
+// both run on the calling thread and take turns. a byte sent on one side can only reach the
+// other when its transfer finishes, a byte time (4096 t-cycles) after it was started at the
+// earliest, so each side runs freely up to that far ahead of the other and they only meet
+// when a transfer finishes. the bytes are swapped with both machines on the same cycle, so
+// a linked run gives the same result every time, however fast the host is.
+//
+// the machine on the internal clock drives the transfer. the other side has to be listening
+// (SC 0x80, external clock) to take part, otherwise the sender reads 0xFF like an empty port
+typedef struct gb_link {
+    gb *gb[2];
+    uint32_t base[2];       // cpu counts when connected, link time is counted from there
+    uint64_t transfers;     // bytes sent over the cable
+} gb_link;
+
+// plug the cable in. the two machines must be different and not already linked
+void gb_link_connect(gb_link *link, gb *a, gb *b);
+
+// unplug it, a transfer waiting on the other side finishes as if nothing was there
+void gb_link_disconnect(gb_link *link);
+
+// gb_run_frame for the first machine, with the second kept in step on the same clock.
+// returns the t-cycles the first one ran
+uint32_t gb_link_run_frame(gb_link *link);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <gb.h>
+
+// input movies
+// every joypad change stamped with the emulated cycle it happened on, so playback feeds
+// the same input at the same point in the game no matter how fast it runs. a movie starts
+// from power on or from a save state stored in it
+//
+// file: header, start state (if any), then one event per change:
+//   [cycles since the previous event, base 128 varint][buttons, GB_BUTTON_* bits]
+
+#define GB_MOVIE_MAGIC 0x564D4247      // "GBMV"
+#define GB_MOVIE_VERSION 1
+
+typedef struct gb_movie {
+    uint8_t *events;
+    size_t size;
+    size_t capacity;
+
+    uint8_t *start_state;       // NULL for power on
+    size_t start_state_size;
+    uint8_t rom_check[4];       // cart type, header checksum and global checksum
+    uint8_t start_buttons;
+    uint64_t length;            // cycles from start to end
+
+    // position, in cycles since the start
+    uint64_t elapsed;
+    uint32_t last_count;        // cpu count elapsed was last brought up to
+    uint64_t last_event;        // when the previous event happened
+    uint8_t buttons;
+    bool recording;
+
+    // playback
+    size_t pos;                 // next event in events
+    uint64_t next_event;        // when it happens
+    uint8_t next_buttons;
+    bool have_next;
+} gb_movie;
+
+// start recording from where the machine is now, from_state stores a save state to start
+// from, otherwise the machine has to be at power on
+gb_movie *gb_movie_record(const gb *gb, bool from_state);
+
+// record the joypad if it changed, call after every input change (and at least every
+// few minutes of emulated time, frame or slice boundaries are fine)
+void gb_movie_sample(gb_movie *movie, const gb *gb);
+
+// end the recording here
+void gb_movie_stop(gb_movie *movie, const gb *gb);
+
+int gb_movie_save(const gb_movie *movie, const char *path);
+gb_movie *gb_movie_load(const char *path);
+void gb_movie_destroy(gb_movie *movie);
+
+// start playing from the beginning: loads the start state, or checks the machine is at
+// power on. returns 0 or -1
+int gb_movie_play(gb_movie *movie, gb *gb);
+
+// gb_run_frame during playback, joypad changes are applied on the cycle they were recorded
+uint32_t gb_movie_run_frame(gb_movie *movie, gb *gb);
+
+bool gb_movie_finished(const gb_movie *movie);
+
+#endif
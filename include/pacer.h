@@ -0,0 +1,41 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define PACER_CLOCK_HZ 4194304     // dmg t-cycles per second
+
+typedef enum pacer_mode {
+    PACER_REALTIME,     // 59.73 Hz, the speed of the real hardware
+    PACER_SPEED,        // a multiple of real time
+    PACER_TURBO         // as fast as the host goes, no sleeping
+} pacer_mode;
+
+// keeps emulated time in step with host time by sleeping against the emulated cycle clock
+// and decides which frames to skip drawing when the host falls behind
+typedef struct pacer {
+    pacer_mode mode;
+    double speed;               // multiplier for PACER_SPEED
+
+    struct timespec base;       // host time at which cycles was 0
+    uint64_t cycles;            // t-cycles emulated since base
+
+    uint8_t max_frame_skip;     // most frames skipped in a row, 0 draws every frame
+    uint8_t frames_skipped;     // skipped in a row so far
+    uint64_t total_skipped;     // for stats
+} pacer;
+
+void pacer_init(pacer *pacer, pacer_mode mode, double speed);
+
+// switch targets, time is measured from now so there's no catching up afterwards
+void pacer_set_mode(pacer *pacer, pacer_mode mode, double speed);
+
+// call at each frame boundary, true if the next frame shouldn't be drawn
+bool pacer_skip_frame(pacer *pacer);
+
+// account for cycles just emulated and sleep until the host catches up with them
+void pacer_wait(pacer *pacer, uint32_t cycles);
+
+#endif
@@ -6,12 +6,21 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 // screen dimensions
 #define SCREEN_WIDTH 160
 #define SCREEN_HEIGHT 144
 #define MAX_SPRITES_PER_LINE 10
 
+// deferred rendering
+#define PPU_VRAM_SIZE 0x2000
+#define PPU_OAM_SIZE 0xA0
+#define PPU_LOG_SIZE 4096
+#define PPU_FRAME_SLOTS 3   // frame logs in flight with a render thread
+#define PPU_QUEUE_SIZE 4
+
 typedef struct {
     uint8_t y_pos;      // y position on screen (stored value + 16)
     uint8_t x_pos;      // x position on screen (stored value + 8)
@@ -21,26 +30,146 @@ typedef struct {
     
 } sprite_data;
 
+// one write to a ppu register, vram or oam made during the visible period
+typedef struct {
+    uint16_t address;
+    uint8_t value;
+    uint8_t ly;         // line the write happened on
+    uint16_t dot;       // dot within that line (0-455)
+} ppu_log_entry;
+
+// the registers the renderer reads
+typedef struct {
+    uint8_t lcdc;
+    uint8_t scy;
+    uint8_t scx;
+    uint8_t wy;
+    uint8_t wx;
+    uint8_t bgp;
+    uint8_t obp0;
+    uint8_t obp1;
+} ppu_registers;
+
+// snapshot of video state taken at frame start, plus every write since
+// the renderer replays the log against the snapshot line by line at vblank
+typedef struct {
+    uint8_t vram[PPU_VRAM_SIZE];
+    uint8_t oam[PPU_OAM_SIZE];
+    ppu_registers regs;
+
+    ppu_log_entry log[PPU_LOG_SIZE];
+    uint16_t log_count;
+
+    uint8_t first_line; // first line not yet rendered
+    uint8_t last_line;  // lines before this have finished mode 3
+    bool end_of_frame;  // hand the frame to the output sink once drawn
+
+    uint32_t stale_pages; // vram pages (256 bytes) that differ from live memory
+    bool oam_stale;       // oam differs from live memory
+    bool oam_changed;     // oam was re-copied, sprite lists need a rebuild
+} ppu_frame_log;
+
+// where finished frames go. the renderer always fills the palette index buffer, and when
+// the sink provides pixel memory it also writes final pixels there through the palette
+// lookup table, in the same pass
+typedef struct ppu_output_sink {
+    void *user;
+
+    // returns pixel memory for the next frame and sets its pitch in bytes,
+    // or NULL to only get palette indices. if not set, pixels/pitch below are used
+    void *(*begin_frame)(void *user, int *pitch);
+
+    // called once the frame is drawn with the palette index buffer and the pixel memory
+    void (*end_frame)(void *user, uint8_t *buffer, void *pixels);
+
+    void *pixels;               // caller provided pixel buffer, NULL for none
+    int pitch;                  // its pitch in bytes, 0 for tightly packed
+
+    uint32_t palette[4];        // final pixel value for each shade
+    uint8_t bytes_per_pixel;    // 1, 2 or 4
+} ppu_output_sink;
+
+// optional extra outputs for machine consumers, drawn in the same pass as the screen
+// a grayscale frame downscaled to width x height (box filtered or strided) and/or a packed
+// 2bpp frame of shades (4 pixels per byte, leftmost in the high bits, 40 bytes per line)
+typedef struct ppu_observation {
+    uint8_t *pixels;            // width * height grayscale bytes, NULL for none
+    uint8_t width;              // 1-160
+    uint8_t height;             // 1-144
+    bool box_filter;            // average every source pixel, otherwise sample the middle one
+    uint8_t gray[4];            // gray level for each shade, all zero for 255/170/85/0
+
+    uint8_t *packed;            // PPU_PACKED_SIZE bytes, NULL for none
+} ppu_observation;
+
+#define PPU_PACKED_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT / 4)
+
+// lookup tables for the downscale, built when the observation is set
+typedef struct {
+    uint8_t row_out[SCREEN_HEIGHT];     // output row each line feeds
+    bool row_emit[SCREEN_HEIGHT];       // output row is complete after this line
+    uint8_t row_count[SCREEN_HEIGHT];   // lines in each output row
+    uint8_t col_out[SCREEN_WIDTH];      // output column each pixel feeds (box filter)
+    uint8_t col_count[SCREEN_WIDTH];    // pixels in each output column
+    uint8_t col_pick[SCREEN_WIDTH];     // pixel sampled for each output column (strided)
+    uint32_t sum[SCREEN_WIDTH];         // box filter accumulators for the current output row
+} ppu_observation_tables;
+
+// lock-free single producer / single consumer ring of frame log slot indices
 typedef struct {
+    uint8_t slots[PPU_QUEUE_SIZE];
+    uint32_t head;  // written by the producer
+    uint32_t tail;  // written by the consumer
+} ppu_queue;
+
+typedef struct ppu {
     // uint8_t screen_buffer[23040];
 
     uint8_t mode;
     uint8_t current_ly;
     uint32_t dot_counter; 
-    uint8_t stat_irq_blocked;
+    uint8_t stat_irq_blocked;   // stat interrupt line, high blocks new requests until it drops
+    bool lcd_enabled;
+    uint32_t frame_count;       // vblanks entered, lets callers run to the end of a frame
+    bool skip_frame;            // don't draw the next frame that starts (frame skip)
+    bool skipping;              // current frame isn't being drawn, nothing is logged
 
     uint8_t sprite_count;
     sprite_data sprite_buffer[MAX_SPRITES_PER_LINE];  // buffer for current scanline sprites
 
+    // oam indices of the sprites on each line, sorted by x then index
+    uint8_t line_sprites[SCREEN_HEIGHT][MAX_SPRITES_PER_LINE];
+    uint8_t line_sprite_count[SCREEN_HEIGHT];
+    bool sprite_lists_dirty;    // rebuild before the next line is drawn
+    uint8_t sprite_lists_lcdc;  // lcdc the lists were built with (sprite size)
+
     uint8_t screen_buffer[SCREEN_WIDTH * SCREEN_HEIGHT];
 
-    // callback
-    void (*frame_complete_callback)(uint8_t *buffer);
+    // output, called from the render thread when one is running
+    ppu_output_sink sink;
+    bool sink_active;       // begin_frame called, end_frame pending
+    void *sink_pixels;
+    int sink_pitch;
+    ppu_observation observation;
+    ppu_observation_tables observation_tables;
 
     // window line counter
     bool window_visible;  // tracks if window coordinates are in valid range
     uint8_t window_line_counter;
 
+    // deferred rendering
+    ppu_frame_log *frame_logs;  // PPU_FRAME_SLOTS slots
+    ppu_frame_log *frame_log;   // slot being logged into, NULL while the renderer has them all
+    bool log_active;            // set while writes need to be logged
+
+    // render thread, owns window_line_counter, the sprite lists, screen_buffer and the sink while active
+    bool render_thread_active;
+    pthread_t render_thread;
+    ppu_queue render_queue;     // slots to draw, cpu -> render thread
+    ppu_queue free_queue;       // drawn slots, render thread -> cpu
+    sem_t render_ready;
+    sem_t render_free;
+
     uint8_t *vram;
     uint8_t *oam;
     bus *bus;
@@ -48,21 +177,32 @@ typedef struct {
 } ppu;
 
 void ppu_init(ppu *ppu, bus *bus);
+void ppu_free(ppu *ppu);
 void ppu_step(ppu *ppu);
-// void ppu_cleanup(ppu *ppu);
-void ppu_set_frame_callback(ppu *ppu, void (*callback)(uint8_t *buffer));
+void ppu_set_output_sink(ppu *ppu, const ppu_output_sink *sink);
+int ppu_set_observation(ppu *ppu, const ppu_observation *observation);
+void ppu_observe_screen(ppu *ppu);
 
 // register functions
 void ppu_write_register(ppu *ppu, uint16_t address, uint8_t value);
 
 // functions for ppu modes
-void ppu_oam_scan(ppu *ppu);
-void ppu_draw(ppu *ppu);
+void ppu_oam_scan(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly);
 
 // interrupts
 void ppu_check_stat_interrupts(ppu *ppu);
 
+// deferred rendering
+void ppu_log_write(ppu *ppu, uint16_t address, uint8_t value);
+void ppu_flush(ppu *ppu);
+void ppu_restart_frame(ppu *ppu);
+
+// render thread
+int ppu_start_render_thread(ppu *ppu);
+void ppu_wait_render(ppu *ppu);
+void ppu_stop_render_thread(ppu *ppu);
+
 // tile and sprite rendering
-void render_scanline(ppu *ppu);
+void ppu_render_scanline(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <gb.h>
+
+// rewind history
+// a save state every interval frames, kept in a fixed size ring. only the newest state is
+// kept whole, every older one is stored as the xor against the state after it, run length
+// encoded (most of memory doesn't change between frames, so the xor is mostly zeros).
+// stepping back loads the newest state and undoes one delta, so it costs one decode.
+// when the ring is full the oldest deltas are dropped
+typedef struct gb_rewind {
+    // ring of encoded deltas, each stored as [size][data][size] so both ends can be walked
+    uint8_t *ring;
+    size_t capacity;
+    size_t head;            // where the next record goes
+    size_t used;            // bytes from the oldest record up to head
+    uint32_t count;         // records in the ring
+
+    size_t state_size;
+    uint8_t *current;       // newest state, whole
+    uint8_t *state;         // the state being taken
+    uint8_t *packed;        // one encoded delta
+    bool have_current;
+
+    uint32_t interval;      // frames between states
+    uint32_t frames;        // frames since the last one
+} gb_rewind;
+
+// budget is the ring size in bytes, on top of two whole states
+// create it once the rom is loaded, the state size depends on the cart
+gb_rewind *gb_rewind_create(const gb *gb, size_t budget, uint32_t interval);
+void gb_rewind_destroy(gb_rewind *rewind);
+void gb_rewind_clear(gb_rewind *rewind);
+
+// take a state now
+void gb_rewind_push(gb_rewind *rewind, const gb *gb);
+
+// call once per frame, takes a state every interval frames
+void gb_rewind_frame(gb_rewind *rewind, const gb *gb);
+
+// load the newest state and drop it from the history, the one before it is next
+// the oldest state stays once everything newer is gone. -1 if there is no history
+int gb_rewind_pop(gb_rewind *rewind, gb *gb);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SHM_SINK_H
+#define SHM_SINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <gb.h>
+
+// frame export to other local processes through posix shared memory
+// the emulator renders every frame straight into a slot of a ring in the shared object and
+// stamps it with a small state header. readers map the same object and read in place, a
+// seqlock per slot tells them whether what they read was torn by the writer
+
+#define SHM_SINK_MAGIC 0x52464247      // "GBFR"
+#define SHM_SINK_VERSION 1
+#define SHM_SINK_SLOTS 4
+
+// machine state at the vblank that finished the frame
+typedef struct shm_frame_header {
+    uint32_t sequence;          // odd while the slot is being written
+    uint32_t frame;             // frame number, counting from 0
+    uint64_t cycles;            // cpu cycle count at vblank
+    uint8_t lcd_registers[12];  // 0xFF40-0xFF4B, lcdc stat scy scx ly lyc dma bgp obp0 obp1 wy wx
+    uint8_t interrupt_flag;     // 0xFF0F
+    uint8_t interrupt_enable;   // 0xFFFF
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp;
+    uint16_t pc;
+} shm_frame_header;
+
+typedef struct shm_frame_slot {
+    shm_frame_header header;
+    uint8_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];   // shades 0-3
+} __attribute__((aligned(64))) shm_frame_slot;
+
+// layout of the shared object
+typedef struct shm_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frames;            // frames published so far, the newest is in slot (frames - 1) % slot_count
+    shm_frame_slot slots[SHM_SINK_SLOTS];
+} shm_ring;
+
+// writer side
+typedef struct shm_sink {
+    char name[64];
+    shm_ring *ring;
+    gb *gb;
+    uint32_t frame;             // frame being drawn
+    shm_frame_slot *slot;       // slot being drawn into, NULL between frames
+} shm_sink;
+
+// create (or replace) /name and start publishing gb's frames to it
+// the header is read from the machine at vblank, so the frame has to be drawn inline:
+// fails if the ppu has a render thread running
+shm_sink *shm_sink_create(const char *name, gb *gb);
+void shm_sink_destroy(shm_sink *sink);
+
+// reader side, maps /name read only
+const shm_ring *shm_ring_open(const char *name);
+void shm_ring_close(const shm_ring *ring);
+
+// copy out the newest complete frame, retrying while the writer is in the middle of it
+// returns its frame number, or -1 if nothing was published yet
+int64_t shm_ring_read_latest(const shm_ring *ring, shm_frame_header *header, uint8_t *pixels);
+
+#endif
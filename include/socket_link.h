@@ -0,0 +1,134 @@
+#ifndef SOCKET_LINK_H
+#define SOCKET_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <gb.h>
+
+// link cable between two processes on one host, over a unix domain socket
+// neither side waits for the other. each runs on, guessing the other side's serial port
+// stays as it last heard, and sends what its own port does stamped with the cycle it
+// happened on (cycles since the link came up, both sides count from the same point). when
+// news arrives that changes something already run, the side loads the newest save state
+// from before it and runs forward again, without drawing the frames it already showed. if
+// that changes what it sent, it takes those messages back and sends the new ones.
+// a side only waits once it gets GB_SOCKET_LINK_LEAD frames ahead of the other, so the
+// history always reaches back far enough. both sides end up agreeing on every byte, and
+// with the same inputs a run always gives the same result
+//
+// the wire format and every timeline below use gb_socket_link_event, in host byte order
+
+#define GB_SOCKET_LINK_HISTORY 64      // save states kept to roll back to, one a frame
+#define GB_SOCKET_LINK_LEAD 48         // frames a side may run ahead of the other
+#define GB_SOCKET_LINK_POLL 4096       // t-cycles between looks at the socket
+
+// event types
+#define GB_LINK_HELLO 1         // first message, the sender's port as the link comes up
+#define GB_LINK_PORT 2          // SB or the SC start/clock bits changed
+#define GB_LINK_TRANSFER 3      // the sender's internal clock transfer finished, sb was sent
+#define GB_LINK_RETRACT 4       // drop every event from the sender at or after time
+#define GB_LINK_TIME 5          // the sender has got this far
+#define GB_LINK_DONE 9          // the sender has stopped, time is its sent << 32 | taken counts
+#define GB_LINK_SENT 6          // ours, not sent: our transfer finished and sb came back
+#define GB_LINK_RECEIVED 7      // ours, not sent: we took sb from their transfer at time
+#define GB_LINK_INPUT 8         // ours, not sent: joypad set to sb
+
+typedef struct gb_socket_link_event {
+    uint64_t time;
+    uint8_t type;
+    uint8_t sb;
+    uint8_t sc;
+    uint8_t reserved[5];
+} gb_socket_link_event;
+
+typedef struct gb_socket_link_log {
+    gb_socket_link_event *events;
+    size_t count;
+    size_t capacity;
+} gb_socket_link_log;
+
+typedef struct gb_socket_link_snapshot {
+    uint64_t time;          // taken before the instruction starting here
+    uint64_t prev;          // when the instruction before that started
+    uint64_t frames;
+    uint64_t frame_start;
+    uint8_t *state;
+} gb_socket_link_snapshot;
+
+typedef struct gb_socket_link {
+    gb *gb;
+    int fd;                 // -1 once the other side has gone
+
+    // our clock
+    uint64_t time;          // t-cycles since the link came up
+    uint64_t prev;          // when the last instruction started
+    uint32_t last_count;    // cpu count time was last brought up to
+    uint64_t next_poll;
+    uint64_t frames;        // frame ends since the link came up, lcd off ones too
+    uint64_t frame_start;   // when the last one was
+    uint64_t frame_target;  // frames the caller has asked for
+
+    // timelines, each in time order
+    gb_socket_link_log ours;    // every port change and transfer we sent
+    gb_socket_link_log theirs;  // what they sent, as it stands
+    gb_socket_link_log used;    // what we took from them (SENT/RECEIVED), to check later
+    gb_socket_link_log input;   // joypad changes, replayed after a rollback
+    size_t replay;              // ours up to here matches what running again has made
+    size_t theirs_next;         // their next event to look at
+    size_t input_next;
+    uint8_t port_sb;            // our port as last sent
+    uint8_t port_sc;
+    uint64_t their_time;        // furthest they've said they got
+    uint64_t time_sent;         // how far we last said we'd got
+    uint32_t sent;              // port, transfer and retract events sent
+    uint32_t received;          // and taken from them
+    uint64_t their_done;        // their last DONE
+    bool their_done_seen;
+    bool settling;
+
+    // messages waiting to go out, and a partly read one
+    gb_socket_link_log out;
+    uint8_t in[sizeof(gb_socket_link_event) * 64];
+    size_t in_size;
+
+    // rollback
+    gb_socket_link_snapshot snapshots[GB_SOCKET_LINK_HISTORY];
+    uint32_t snapshot_head;     // where the next one goes
+    uint32_t snapshot_count;
+    uint64_t snapshot_frame;    // frames at the newest one
+    size_t state_size;
+    uint64_t redo_frame;        // frames before this were already shown, don't draw them again
+    bool redoing;
+    bool skip_frame;            // the caller's frame skip, put back once caught up
+
+    // stats
+    uint64_t transfers;         // bytes through our port too old to roll back
+    uint64_t rollbacks;
+    uint64_t replayed;          // t-cycles taken back to run again
+} gb_socket_link;
+
+// bytes that went through our port, as things stand
+static inline uint64_t gb_socket_link_transfers(const gb_socket_link *link) {
+    return link->transfers + link->used.count;
+}
+
+// wait for the other process to connect on path, or connect to one waiting there.
+// the machine should be at the point both sides start from. NULL on error
+gb_socket_link *gb_socket_link_listen(gb *gb, const char *path);
+gb_socket_link *gb_socket_link_connect(gb *gb, const char *path);
+void gb_socket_link_destroy(gb_socket_link *link);
+
+// gb_run_frame over the link. a rollback can happen in any call, rerunning earlier frames
+// with drawing skipped. returns the t-cycles the link clock moved on
+uint32_t gb_socket_link_run_frame(gb_socket_link *link);
+
+// stop here: keep swapping news with the other side, rolling back and running up to here
+// again, until neither side can change. both sides call it at the end of a run, after it
+// the link is only good for gb_socket_link_destroy
+void gb_socket_link_settle(gb_socket_link *link);
+
+// gb_set_joypad for a linked machine, so a rollback replays it on the same cycle
+void gb_socket_link_set_joypad(gb_socket_link *link, uint8_t buttons);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <gb.h>
+
+// save states
+// the whole machine as a compact binary blob: a versioned header, the cpu/bus/ppu fields,
+// then only the memory that is real hardware (vram, wram, oam, io/hram, and cart ram when
+// the cart has it). rom is never stored, a state only loads into a gb running the same rom.
+// states are in host byte order and meant to be cheap enough to take every frame
+
+#define GB_STATE_MAGIC 0x53534247      // "GBSS"
+#define GB_STATE_VERSION 2
+
+// header flags
+#define GB_STATE_CART_RAM 0x0001       // 0xA000-0xBFFF is stored
+
+// the rom a state belongs to: cart type, header checksum and global checksum
+void gb_state_rom_check(const gb *gb, uint8_t *check);
+
+// bytes gb_save_state needs for this machine
+size_t gb_state_size(const gb *gb);
+
+// returns the bytes written, or 0 if the buffer is too small
+size_t gb_save_state(const gb *gb, uint8_t *buffer, size_t size);
+
+// returns 0, or -1 if the state is damaged, from another version or for another rom
+// the frame being drawn is dropped, drawing picks up again from the loaded line
+int gb_load_state(gb *gb, const uint8_t *buffer, size_t size);
+
+int gb_save_state_file(const gb *gb, const char *path);
+int gb_load_state_file(gb *gb, const char *path);
+
+// a state file mapped read-only and copy-on-write, for resuming many instances (or
+// processes) from one snapshot: every gb_load_state from it shares the file's pages
+typedef struct gb_state_map {
+    const uint8_t *data;
+    size_t size;
+} gb_state_map;
+
+int gb_state_map_open(gb_state_map *map, const char *path);
+void gb_state_map_close(gb_state_map *map);
+
+// fingerprint of everything a save state holds, for checking two runs stay in step frame
+// by frame. memory is hashed in 256 byte pages and only the pages written since the last
+// call are rehashed, so once a frame costs well under a microsecond. equal states always
+// hash equal, different ones almost never do
+uint64_t gb_state_hash(gb *gb);
+
+// fnv-1a over the palette indices of a drawn frame (SCREEN_WIDTH * SCREEN_HEIGHT bytes, like
+// ppu screen_buffer), the frame hash the headless and batch runners print
+#define GB_FNV_OFFSET 14695981039346656037ULL
+#define GB_FNV_PRIME 1099511628211ULL
+uint64_t gb_frame_hash(const uint8_t *frame);
+
+// run-ahead: run one frame, but show the frame ahead frames after it in its place, so the
+// game reacts to input that many frames sooner. the frames past the real one are run from
+// a save state with drawing skipped until the last, then the state is loaded back.
+// state is scratch of gb_state_size bytes. returns the t-cycles of the real frame
+uint32_t gb_run_frame_ahead(gb *gb, uint32_t ahead, uint8_t *state, size_t size);
+
+#endif
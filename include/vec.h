@@ -0,0 +1,82 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <gb.h>
+#include <state.h>
+
+#define GB_VEC_FRAME_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+// vectorized environments for reinforcement learning
+// N instances of one rom stepped together on worker threads. each step applies one action
+// (GB_BUTTON_* mask) per env, runs frames_per_step frames and writes every env's last frame
+// into one contiguous [N][144][160] array of shades (0-3), plus selected memory bytes
+typedef struct gb_vec_env {
+    gb *gb;
+    bool frame_written;     // the renderer wrote this step's frame straight into the output
+} gb_vec_env;
+
+typedef struct gb_vec {
+    gb_vec_env *envs;
+    int count;
+    const char *rom_path;
+    gb *boot;                   // the rom at power on, never run. envs share its rom
+    uint32_t frames_per_step;
+    gb_state_map start_state;   // episodes start here instead of at power on, if mapped
+
+    // downscaled grayscale frames instead of full ones, 0 for full frames
+    uint8_t observation_width;
+    uint8_t observation_height;
+    bool observation_box_filter;
+
+    // bytes copied into the ram observation, in order
+    uint16_t *ram_addresses;
+    int ram_count;
+
+    // worker pool, envs are handed out one at a time from next_env
+    int threads;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    uint32_t generation;    // bumped for every step
+    int busy;               // workers still in the current step
+    bool stopping;
+
+    // current step
+    const uint8_t *actions;
+    uint8_t *frames;
+    uint8_t *ram;
+    int next_env;
+} gb_vec;
+
+// threads is the number of worker threads on top of the caller, 0 for one per online cpu
+gb_vec *gb_vec_create(const char *rom_path, int count, uint32_t frames_per_step, int threads);
+void gb_vec_destroy(gb_vec *vec);
+
+// addresses to read after every step, ram gets count * ram_count bytes
+int gb_vec_set_ram_observation(gb_vec *vec, const uint16_t *addresses, int count);
+
+// observe width x height grayscale frames (box filtered or strided) instead of full shade
+// frames, drawn by the renderer in the same pass. 0x0 goes back to full frames
+int gb_vec_set_observation(gb_vec *vec, uint8_t width, uint8_t height, bool box_filter);
+
+// start every episode from a save state file instead of power on, mapped once and shared
+// by all envs. moves every env there now, later gb_vec_reset calls go back to it. a state
+// that doesn't load leaves the envs and the old start state as they were
+int gb_vec_set_start_state(gb_vec *vec, const char *path);
+
+// bytes per env in the frames array
+size_t gb_vec_frame_size(const gb_vec *vec);
+
+// power cycle one env (or load the start state), for the start of a new episode
+int gb_vec_reset(gb_vec *vec, int env);
+
+// actions has one byte per env, frames is [count][144][160] (or [count][height][width] with
+// an observation set), ram may be NULL
+void gb_vec_step(gb_vec *vec, const uint8_t *actions, uint8_t *frames, uint8_t *ram);
+
+#endif
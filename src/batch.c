@@ -0,0 +1,356 @@
+#define _GNU_SOURCE     // pthread_setaffinity_np
+
+#include "../include/batch.h"
+#include "../include/state.h"
+#include "../include/gb.h"
+#include "../include/bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+// batch runner
+// every job is one task at a time in some worker's deque. a worker pops from the bottom of
+// its own deque, runs that instance for a quantum of frames and pushes it back, so instances
+// mostly stay on the worker (and cache) they started on. idle workers steal from the top of
+// other deques, which evens out roms and scripts that run at different speeds.
+//
+// the deques are chase-lev: lock-free, the owner works the bottom and thieves cas the top.
+// they never grow, a deque can hold every job at once
+
+#define BATCH_EMPTY -1
+
+typedef struct batch_deque {
+    int64_t top;        // next to steal, advanced by cas
+    int64_t bottom;     // next free slot, owner only
+    int32_t *tasks;
+    int64_t mask;
+} __attribute__((aligned(64))) batch_deque;
+
+typedef struct batch_pool {
+    gb_batch_job *jobs;
+    int count;
+    int threads;
+    uint32_t quantum;
+    bool pin_threads;
+    batch_deque *deques;
+    int remaining;      // jobs not finished yet
+    uint64_t steals;
+} batch_pool;
+
+typedef struct batch_worker {
+    batch_pool *pool;
+    int id;
+    pthread_t thread;
+} batch_worker;
+
+static void batch_push(batch_deque *deque, int32_t task) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->tasks[bottom & deque->mask], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+// owner side, takes the newest task
+static int32_t batch_pop(batch_deque *deque) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        // empty
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return BATCH_EMPTY;
+    }
+
+    int32_t task = __atomic_load_n(&deque->tasks[bottom & deque->mask], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // last one, race the thieves for it
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = BATCH_EMPTY;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+// thief side, takes the oldest task
+static int32_t batch_steal(batch_deque *deque) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom) {
+        return BATCH_EMPTY;
+    }
+    int32_t task = __atomic_load_n(&deque->tasks[top & deque->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        // lost to the owner or another thief
+        return BATCH_EMPTY;
+    }
+    return task;
+}
+
+static double batch_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// put a new machine where the job starts, from its start state or a copy of its boot machine.
+// either way the rom is boot's
+static int batch_start_job(gb_batch_job *job) {
+    if (job->start_state != NULL) {
+        bus_share_rom(&job->gb->cpu.bus, job->boot->cpu.bus.rom);
+        return gb_load_state(job->gb, job->start_state, job->start_state_size);
+    }
+    return gb_copy(job->gb, job->boot);
+}
+
+// run one quantum of a job, returns true once the job is finished
+static bool batch_run_task(gb_batch_job *job, uint32_t quantum) {
+    // created on first use so its memory is first touched by the worker that runs it
+    if (job->gb == NULL) {
+        job->gb = job->boot != NULL ? gb_create() : NULL;
+        if (job->gb == NULL || batch_start_job(job) != 0) {
+            job->error = -1;
+            gb_destroy(job->gb);
+            job->gb = NULL;
+            return true;
+        }
+    }
+
+    double start = batch_now();
+    for (uint32_t i = 0; i < quantum && job->frames_run < job->frames; i++) {
+        while (job->next_input < job->input_count && job->inputs[job->next_input].frame <= job->frames_run) {
+            gb_set_joypad(job->gb, job->inputs[job->next_input].buttons);
+            job->next_input++;
+        }
+        job->cycles += gb_run_frame(job->gb);
+        job->frames_run++;
+    }
+    job->seconds += batch_now() - start;
+
+    if (job->frames_run < job->frames) {
+        return false;
+    }
+    job->screen_hash = gb_frame_hash(job->gb->ppu.screen_buffer);
+    gb_destroy(job->gb);
+    job->gb = NULL;
+    return true;
+}
+
+static void *batch_worker_thread(void *arg) {
+    batch_worker *worker = arg;
+    batch_pool *pool = worker->pool;
+    batch_deque *own = &pool->deques[worker->id];
+
+    if (pool->pin_threads) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    while (__atomic_load_n(&pool->remaining, __ATOMIC_ACQUIRE) > 0) {
+        int32_t task = batch_pop(own);
+
+        if (task == BATCH_EMPTY) {
+            for (int i = 1; i < pool->threads && task == BATCH_EMPTY; i++) {
+                task = batch_steal(&pool->deques[(worker->id + i) % pool->threads]);
+            }
+            if (task == BATCH_EMPTY) {
+                // everything left is being run by someone else right now
+                sched_yield();
+                continue;
+            }
+            __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
+        }
+
+        if (batch_run_task(&pool->jobs[task], pool->quantum)) {
+            __atomic_fetch_sub(&pool->remaining, 1, __ATOMIC_ACQ_REL);
+        } else {
+            batch_push(own, task);
+        }
+    }
+    return NULL;
+}
+
+int gb_batch_run(gb_batch_job *jobs, int count, const gb_batch_options *options, gb_batch_stats *stats) {
+    batch_pool pool;
+    pool.jobs = jobs;
+    pool.count = count;
+    pool.threads = options->threads > 0 ? options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (pool.threads > count) {
+        pool.threads = count;
+    }
+    if (pool.threads < 1) {
+        pool.threads = 1;
+    }
+    pool.quantum = options->quantum > 0 ? options->quantum : BATCH_DEFAULT_QUANTUM;
+    pool.pin_threads = options->pin_threads;
+    pool.remaining = count;
+    pool.steals = 0;
+
+    // each deque can hold every job, so a push never has to grow it
+    int64_t capacity = 1;
+    while (capacity < count) {
+        capacity <<= 1;
+    }
+
+    pool.deques = aligned_alloc(64, pool.threads * sizeof(batch_deque));
+    batch_worker *workers = malloc(pool.threads * sizeof(batch_worker));
+    int32_t *tasks = malloc(pool.threads * capacity * sizeof(int32_t));
+    if (pool.deques == NULL || workers == NULL || tasks == NULL) {
+        fprintf(stderr, "Failed to allocate memory for batch workers\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < pool.threads; i++) {
+        pool.deques[i].top = 0;
+        pool.deques[i].bottom = 0;
+        pool.deques[i].tasks = &tasks[i * capacity];
+        pool.deques[i].mask = capacity - 1;
+    }
+
+    // every distinct rom is loaded once, up front, into a boot machine that is never run.
+    // jobs start from a copy of it
+    gb **boots = calloc(count > 0 ? count : 1, sizeof(gb *));
+    if (boots == NULL) {
+        fprintf(stderr, "Failed to allocate memory for batch roms\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        jobs[i].boot = NULL;
+        for (int j = 0; j < i; j++) {
+            if (strcmp(jobs[j].rom_path, jobs[i].rom_path) == 0) {
+                jobs[i].boot = jobs[j].boot;
+                break;
+            }
+        }
+        if (jobs[i].boot == NULL) {
+            boots[i] = gb_create();
+            if (boots[i] != NULL && gb_load_rom(boots[i], jobs[i].rom_path) != 0) {
+                gb_destroy(boots[i]);
+                boots[i] = NULL;
+            }
+            jobs[i].boot = boots[i];
+        }
+    }
+
+    // deal the jobs out round robin, stealing evens out the rest
+    for (int i = 0; i < count; i++) {
+        jobs[i].frames_run = 0;
+        jobs[i].cycles = 0;
+        jobs[i].seconds = 0;
+        jobs[i].screen_hash = 0;
+        jobs[i].error = 0;
+        jobs[i].gb = NULL;
+        jobs[i].next_input = 0;
+        batch_push(&pool.deques[i % pool.threads], i);
+    }
+
+    double start = batch_now();
+    int started = 0;
+    int result = 0;
+    for (; started < pool.threads; started++) {
+        workers[started].pool = &pool;
+        workers[started].id = started;
+        if (pthread_create(&workers[started].thread, NULL, batch_worker_thread, &workers[started]) != 0) {
+            fprintf(stderr, "failed to start batch worker\n");
+            result = -1;
+            break;
+        }
+    }
+
+    // workers steal from every deque, so with at least one running the jobs still all finish.
+    // with none the calling thread does the work
+    if (started == 0) {
+        batch_worker self;
+        self.pool = &pool;
+        self.id = 0;
+        batch_worker_thread(&self);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    if (stats != NULL) {
+        stats->threads = started > 0 ? started : 1;
+        stats->seconds = batch_now() - start;
+        stats->steals = pool.steals;
+        stats->frames = 0;
+        for (int i = 0; i < count; i++) {
+            stats->frames += jobs[i].frames_run;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        gb_destroy(boots[i]);
+        jobs[i].boot = NULL;
+    }
+    free(boots);
+    free(tasks);
+    free(workers);
+    free(pool.deques);
+    return result;
+}
+
+int batch_load_inputs(const char *path, batch_input **inputs) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open input script: %s\n", path);
+        return -1;
+    }
+
+    int count = 0;
+    int capacity = 64;
+    *inputs = malloc(capacity * sizeof(batch_input));
+    if (*inputs == NULL) {
+        fprintf(stderr, "Failed to allocate memory for input script\n");
+        exit(1);
+    }
+
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        unsigned long frame;
+        unsigned int buttons;
+        int fields = sscanf(line, "%lu %x", &frame, &buttons);
+        if (fields == EOF) {
+            continue;   // blank
+        }
+        if (fields != 2 || buttons > 0xFF) {
+            fprintf(stderr, "%s:%d: expected \"frame buttons\"\n", path, line_number);
+            fclose(file);
+            free(*inputs);
+            *inputs = NULL;
+            return -1;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            *inputs = realloc(*inputs, capacity * sizeof(batch_input));
+            if (*inputs == NULL) {
+                fprintf(stderr, "Failed to allocate memory for input script\n");
+                exit(1);
+            }
+        }
+        (*inputs)[count].frame = (uint32_t)frame;
+        (*inputs)[count].buttons = (uint8_t)buttons;
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
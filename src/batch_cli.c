@@ -0,0 +1,119 @@
+#include "../include/batch.h"
+#include "../include/state.h"
+#include "../include/gb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// batch runner cli
+// each rom argument is one instance, optionally with an input script after a colon
+//   gameboy-batch [-t threads] [-n frames] [-q quantum] [-c copies] [--pin] rom.gb[:script.txt] ...
+
+#define DEFAULT_FRAMES 600
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t threads] [-n frames] [-q quantum] [-c copies] [--pin] [--resume state.bin] rom.gb[:inputs.txt] ...\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    gb_batch_options options = { 0, 0, false };
+    uint32_t frames = DEFAULT_FRAMES;
+    int copies = 1;
+    int first_rom = argc;
+    const char *resume_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            frames = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            options.quantum = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            copies = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            options.pin_threads = true;
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            first_rom = i;
+            break;
+        }
+    }
+
+    int roms = argc - first_rom;
+    if (roms <= 0 || copies < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // every instance starts from the same mapped snapshot
+    gb_state_map resume = { NULL, 0 };
+    if (resume_path != NULL && gb_state_map_open(&resume, resume_path) != 0) {
+        return 1;
+    }
+
+    int count = roms * copies;
+    gb_batch_job *jobs = calloc(count, sizeof(gb_batch_job));
+    batch_input **scripts = calloc(roms, sizeof(batch_input *));
+    if (jobs == NULL || scripts == NULL) {
+        fprintf(stderr, "Failed to allocate memory for batch jobs\n");
+        return 1;
+    }
+
+    for (int r = 0; r < roms; r++) {
+        // rom.gb:inputs.txt, split in place
+        char *rom_path = argv[first_rom + r];
+        char *script = strchr(rom_path, ':');
+        int input_count = 0;
+        if (script != NULL) {
+            *script++ = '\0';
+            input_count = batch_load_inputs(script, &scripts[r]);
+            if (input_count < 0) {
+                return 1;
+            }
+        }
+
+        for (int c = 0; c < copies; c++) {
+            gb_batch_job *job = &jobs[r * copies + c];
+            job->rom_path = rom_path;
+            job->inputs = scripts[r];
+            job->input_count = input_count;
+            job->frames = frames;
+            job->start_state = resume.data;
+            job->start_state_size = resume.size;
+        }
+    }
+
+    gb_batch_stats stats;
+    if (gb_batch_run(jobs, count, &options, &stats) < 0) {
+        fprintf(stderr, "some batch workers failed to start\n");
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        gb_batch_job *job = &jobs[i];
+        if (job->error) {
+            printf("instance %d %s: failed to load\n", i, job->rom_path);
+            failed++;
+            continue;
+        }
+        printf("instance %d %s: %u frames, %.1f fps, hash %016llx\n", i, job->rom_path,
+               job->frames_run, job->frames_run / job->seconds, (unsigned long long)job->screen_hash);
+    }
+    printf("total: %d instances, %llu frames in %.3f s on %d threads, %.1f fps (%.1fx real time), %llu steals\n",
+           count, (unsigned long long)stats.frames, stats.seconds, stats.threads,
+           stats.frames / stats.seconds, stats.frames / stats.seconds / 59.7275,
+           (unsigned long long)stats.steals);
+
+    for (int r = 0; r < roms; r++) {
+        free(scripts[r]);
+    }
+    free(scripts);
+    free(jobs);
+    gb_state_map_close(&resume);
+    return failed ? 1 : 0;
+}
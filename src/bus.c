@@ -1,4 +1,6 @@
 #include "../include/bus.h"
+#include "../include/cpu.h"
+#include "../include/ppu.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,10 +34,34 @@ void bus_init(bus *bus) {
 
     // mbc basics
     bus->rom_data = NULL;      
+    bus->rom = NULL;
     bus->mbc_type = 0;         
     bus->rom_bank = 0;         
     bus->ram_bank = 0;
     bus->ram_enabled = 0;
+
+    bus->ppu = NULL;
+    bus->vram_dirty = 0xFFFFFFFF;
+    bus->oam_dirty = true;
+    memset(bus->page_dirty, 0xFF, sizeof(bus->page_dirty));
+
+    bus->serial_cycles = 0;
+    bus->serial_due = false;
+    bus->serial_linked = false;
+}
+
+// note a memory write for gb_state_hash. io and hram aren't tracked, that page changes
+// every few cycles anyway so it's always rehashed
+static inline void bus_mark_page(bus *bus, uint16_t address) {
+    uint8_t page = (address - 0x8000) >> 8;
+    bus->page_dirty[page >> 6] |= 1ull << (page & 63);
+}
+
+// hand video writes to the ppu so the deferred renderer sees them in order
+static inline void bus_log_ppu_write(bus *bus, uint16_t address, uint8_t value) {
+    if (bus->ppu != NULL && bus->ppu->log_active) {
+        ppu_log_write(bus->ppu, address, value);
+    }
 }
 
 // free bus memory
@@ -44,6 +70,57 @@ void bus_free(bus *bus) {
         free(bus->memory);
         bus->memory = NULL;
     }
+    bus_release_rom(bus);
+}
+
+// use another bus's rom, dropping our own
+void bus_share_rom(bus *bus, bus_rom *rom) {
+    if (bus->rom == rom) {
+        return;
+    }
+    bus_release_rom(bus);
+    if (rom != NULL) {
+        __atomic_add_fetch(&rom->refs, 1, __ATOMIC_RELAXED);
+        bus->rom = rom;
+        bus->rom_data = rom->data;
+    }
+}
+
+void bus_release_rom(bus *bus) {
+    if (bus->rom != NULL && __atomic_sub_fetch(&bus->rom->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(bus->rom);
+    }
+    bus->rom = NULL;
+    bus->rom_data = NULL;
+}
+
+// joypad
+// P1 bits 0-3 as the game reads them, low for a pressed key in a selected group
+// a group is selected by clearing its select bit, with both selected the lines are and-ed
+uint8_t bus_joypad_lines(bus *bus) {
+    uint8_t lines = 0x0F;
+    if (!(bus->joypad_select & 0x20)) {  // buttons
+        lines &= bus->button_state;
+    }
+    if (!(bus->joypad_select & 0x10)) {  // dpad
+        lines &= bus->dpad_state;
+    }
+    return lines & 0x0F;
+}
+
+// request the joypad interrupt if any line went from high to low
+void bus_joypad_changed(bus *bus, uint8_t old_lines) {
+    if (old_lines & ~bus_joypad_lines(bus)) {
+        bus->memory[0xFF0F] |= 0x10;
+    }
+}
+
+// set which keys are held, active low like the lines
+void bus_set_joypad(bus *bus, uint8_t dpad_state, uint8_t button_state) {
+    uint8_t lines = bus_joypad_lines(bus);
+    bus->dpad_state = dpad_state & 0x0F;
+    bus->button_state = button_state & 0x0F;
+    bus_joypad_changed(bus, lines);
 }
 
 uint8_t bus_read8(bus *bus, uint16_t address) {
@@ -79,17 +156,7 @@ uint8_t bus_read8(bus *bus, uint16_t address) {
         }
         // maybe trigger some graphics update
     } if (address == 0xFF00) {
-        // start with all bits set except select bits
-        uint8_t result = 0xCF | (bus->joypad_select & 0x30);
-        
-        // check each select bit independently
-        if (!(bus->joypad_select & 0x20)) {  // buttons
-            result = (result & 0xF0) | (bus->button_state & 0x0F);
-        }
-        if (!(bus->joypad_select & 0x10)) {  // dpad
-            result = (result & 0xF0) | (bus->dpad_state & 0x0F);
-        }
-        return result;
+        return 0xC0 | (bus->joypad_select & 0x30) | bus_joypad_lines(bus);
     }
     return bus->memory[address];
 }
@@ -103,8 +170,11 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value) {
         bus->ram_enabled = (value == 0x0a);
     } 
     else if (address < 0x4000) {
-        // rom bank switch
+        // rom bank switch, wrapped to the banks the rom has like the mbc's unused lines
         bus->rom_bank = value & 0x7f;
+        if (bus->rom != NULL && bus->rom->size >= 0x8000) {
+            bus->rom_bank %= bus->rom->size / 0x4000;
+        }
         if (bus->rom_bank == 0) {
             bus->rom_bank = 1;
         }
@@ -113,6 +183,9 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value) {
         // ram bank 
         bus->ram_bank = value & 0x03;
 
+    } else if (address < 0x8000) {
+        // banking mode / rtc latch, neither is emulated
+
     } else if (address < 0xA000) {
         // VRAM
         // we need to check the PPU mode here
@@ -120,28 +193,36 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value) {
         // any attempts to write during mode 3 are ignored 
         if ((bus->memory[0xFF41] & 0x03) != 3) {
             bus->memory[address] = value;
+            bus->vram_dirty |= 1u << ((address - 0x8000) >> 8);
+            bus_mark_page(bus, address);
+            bus_log_ppu_write(bus, address, value);
         }
-
-        // maybe trigger some graphics update
     } else if (address < 0xC000) {
         // external RAM
         // printf("writing to WRAM");
         bus->memory[address] = value;
+        bus_mark_page(bus, address);
     } else if (address < 0xE000) {
         // WRAM
         bus->memory[address] = value;
+        bus_mark_page(bus, address);
         // mirror to echo RAM
         if (address < 0xDE00) {
             bus->memory[address + 0x2000] = value;
         }
     } else if (address < 0xFE00) {
-        // echo RAM - write to WRAM instead
+        // echo RAM - write to WRAM, and keep the mirror in step
         bus->memory[address - 0x2000] = value;
+        bus->memory[address] = value;
+        bus_mark_page(bus, address - 0x2000);
     } else if (address < 0xFEA0) {
         // OAM
         // oam is only accessible during modes 0 and 1
         if ((bus->memory[0xFF41] & 0x03) != 0 || (bus->memory[0xFF41] & 0x03) != 1) {
             bus->memory[address] = value;
+            bus->oam_dirty = true;
+            bus_mark_page(bus, address);
+            bus_log_ppu_write(bus, address, value);
         }
 
         // bus->memory[address] = value;
@@ -155,9 +236,20 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value) {
 
         // }
 
+        // serial control, bit 7 starts a transfer and bit 0 picks our clock over the other side's
+        if (address == 0xFF02) {
+            bus->memory[address] = value | 0x7E;
+            bus->serial_cycles = (value & 0x81) == 0x81 ? SERIAL_TRANSFER_CYCLES : 0;
+            bus->serial_due = false;
+            return;
+        }
+
         // // input register
         if (address == 0xFF00) {
-            bus->joypad_select = (value & 0x30) | 0xCF;  // only bits 4-5 writable
+            // only bits 4-5 writable, selecting a held key pulls its line low too
+            uint8_t lines = bus_joypad_lines(bus);
+            bus->joypad_select = (value & 0x30) | 0xCF;
+            bus_joypad_changed(bus, lines);
             return;
             }
         
@@ -180,16 +272,22 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value) {
         // }
 
         else if (address == 0xFF41) {
-            // make exception for PPU writes
-            // this is hacky but works for now
-            if (value & 0x04 || !(value & 0x04)) {  // if setting or clearing bit 2
-                bus->memory[address] = value;  // allow full write from PPU
-            } else {
-                // normal case - only bits 3-6 writable
-                uint8_t current = bus_read8(bus, 0xFF41);
-                uint8_t writable_bits = value & 0x78;
-                uint8_t readonly_bits = current & 0x87;
-                bus->memory[address] = writable_bits | readonly_bits;
+            // only bits 3-6 writable, the ppu sets mode and LYC bits in memory directly
+            uint8_t writable_bits = value & 0x78;
+            uint8_t readonly_bits = bus->memory[address] & 0x87;
+            bus->memory[address] = writable_bits | readonly_bits;
+            // enable bits changed, recompute the stat interrupt line
+            if (bus->ppu != NULL) {
+                ppu_check_stat_interrupts(bus->ppu);
+            }
+            return;
+        }
+
+        else if (address == 0xFF45) {
+            // LYC, the LY=LYC condition may have changed
+            bus->memory[address] = value;
+            if (bus->ppu != NULL) {
+                ppu_check_stat_interrupts(bus->ppu);
             }
             return;
         }
@@ -200,11 +298,27 @@ void bus_write8(bus *bus, uint16_t address, uint8_t value) {
             // take the written value and shift 8 bits left
             uint16_t source = value << 8;
             // take 160 bytes and copy to OAM (#FE00-#FE9F)
-            memcpy(&bus->memory[0xFE00], &bus->memory[source], 160);
+            // rom comes from the rom itself like bus_read8, memory only holds a copy of the
+            // first 32k from load_rom, which a state load into a clone doesn't fill
+            const uint8_t *from = &bus->memory[source];
+            if (source < 0x4000) {
+                from = &bus->rom_data[source];
+            } else if (source < 0x8000) {
+                from = &bus->rom_data[(source - 0x4000) + (bus->rom_bank * 0x4000)];
+            }
+            memcpy(&bus->memory[0xFE00], from, 160);
+            bus->oam_dirty = true;
+            bus_mark_page(bus, 0xFE00);
+            bus_log_ppu_write(bus, address, value);
         }
 
         else {
             bus->memory[address] = value;
+            // lcdc, scroll, palette and window registers
+            if (address == 0xFF40 || address == 0xFF42 || address == 0xFF43 ||
+                (address >= 0xFF47 && address <= 0xFF4B)) {
+                bus_log_ppu_write(bus, address, value);
+            }
             return;
         }
     } else {
@@ -233,6 +347,32 @@ void bus_increment_div(bus *bus) {
     bus->memory[0xFF04]++;
 }
 
+// serial
+// a transfer on our own clock runs for a byte time. with no cable that's the end of it and
+// the other side reads as all ones, with a cable the link swaps the bytes once both
+// machines have got there. on the other side's clock nothing happens until it sends
+void bus_serial_tick(bus *bus, uint32_t cycles) {
+    if (cycles < bus->serial_cycles) {
+        bus->serial_cycles -= cycles;
+        return;
+    }
+    bus->serial_cycles = 0;
+    if (bus->serial_linked) {
+        bus->serial_due = true;
+    } else {
+        bus_serial_complete(bus, 0xFF);
+    }
+}
+
+// the byte is in, clear the start bit and request the serial interrupt
+void bus_serial_complete(bus *bus, uint8_t received) {
+    bus->memory[0xFF01] = received;
+    bus->memory[0xFF02] &= ~0x80;
+    bus->memory[0xFF0F] |= 0x08;
+    bus->serial_cycles = 0;
+    bus->serial_due = false;
+}
+
 // load ROM memory
 // In each cartridge, the required (or preferred) MBC type should be specified in the byte at $0147 of the ROM, as described in the cartridge header.
 
@@ -282,21 +422,24 @@ int load_rom(bus *bus, const char *rom_path) {
     printf("ROM file size: %ld bytes\n", file_size);
 
     // allocate memory for full ROM
-    bus->rom_data = malloc(file_size);
-    if (bus->rom_data == NULL) {
+    bus_rom *rom = malloc(sizeof(bus_rom) + file_size);
+    if (rom == NULL) {
         printf("Failed to allocate ROM memory\n");
         fclose(file);
         return -1;
     }
 
     // read entire ROM
-    size_t bytes_read = fread(bus->rom_data, 1, file_size, file);
+    size_t bytes_read = fread(rom->data, 1, file_size, file);
     if (bytes_read != file_size) {
         fprintf(stderr, "Failed to read ROM\n");
-        free(bus->rom_data);
+        free(rom);
         fclose(file);
         return -1;
     }
+    rom->refs = 0;
+    rom->size = bytes_read;
+    bus_share_rom(bus, rom);
 
     // copy first bank to main memory
     memcpy(bus->memory, bus->rom_data, 0x8000);
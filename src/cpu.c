@@ -147,7 +147,7 @@ void cpu_handle_interrupts(cpu *cpu) {
         // set PC to the Vblank interrupt handler address
         cpu->registers.pc = 0x0040;
     } else if (requested & 0x02) {  // LCD status
-        printf("handling stat interrupt\n");
+        // printf("handling stat interrupt\n");
         // printf("handling STAT interrupt, PC was: %04X\n", cpu->registers.pc);
         // printf("writing to IF at addr=%04X clearing bit 1\n", 0xFF0F);
         // uint16_t if_addr = 0xFF0F;
@@ -172,7 +172,7 @@ void cpu_handle_interrupts(cpu *cpu) {
         // set PC to the Timer Overflow interrupt handler address
         cpu->registers.pc = 0x0050;
     } else if (requested & 0x08) {  // serial link
-        printf("handling serial link interrupt\n");
+        // printf("handling serial link interrupt\n");
         bus_write8(&cpu->bus, 0xFF0F, if_ & ~0x08); 
         bus_write8(&cpu->bus, --cpu->registers.sp, cpu->registers.pc >> 8);
         bus_write8(&cpu->bus, --cpu->registers.sp, cpu->registers.pc & 0xFF);
@@ -182,7 +182,7 @@ void cpu_handle_interrupts(cpu *cpu) {
         // set PC to the Serial Link interrupt handler address
         cpu->registers.pc = 0x0058;
     } else if (requested & 0x10) {  // joypad press
-        printf("handling joypad press interrupt\n");
+        // printf("handling joypad press interrupt\n");
         bus_write8(&cpu->bus, 0xFF0F, if_ & ~0x10);
         bus_write8(&cpu->bus, --cpu->registers.sp, cpu->registers.pc >> 8);
         bus_write8(&cpu->bus, --cpu->registers.sp, cpu->registers.pc & 0xFF);
@@ -240,7 +240,7 @@ void cpu_update_timers(cpu *cpu) {
 // T-cycles for opcodes
 // from greg tourville
 
-uint8_t op_tcycles[0x100] = {
+static const uint8_t op_tcycles[0x100] = {
 	//   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
 	4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,    // 0x00
 	4,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x10
@@ -300,6 +300,11 @@ void cpu_step(cpu *cpu) {
     // call update timers
     cpu_update_timers(cpu);
 
+    // serial transfer on our own clock
+    if (cpu->bus.serial_cycles > 0) {
+        bus_serial_tick(&cpu->bus, cpu->counter);
+    }
+
     // update the total cycle count
     cpu->count += cpu->counter;
 
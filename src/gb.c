@@ -0,0 +1,152 @@
+#include "../include/gb.h"
+#include "../include/cpu.h"
+#include "../include/bus.h"
+#include "../include/ppu.h"
+#include "../include/state.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// power on a machine with the DMG post boot register values
+void gb_init(gb *gb) {
+    memset(&gb->cpu, 0, sizeof(cpu));
+
+    bus_init(&gb->cpu.bus);
+    cpu_init(&gb->cpu, &gb->ppu);
+    cpu_init_test(&gb->cpu.registers);
+    ppu_init(&gb->ppu, &gb->cpu.bus);
+    memset(&gb->input, 0, sizeof(gb_input_queue));
+    memset(gb->page_hashes, 0, sizeof(gb->page_hashes));
+}
+
+void gb_free(gb *gb) {
+    ppu_free(&gb->ppu);
+    bus_free(&gb->cpu.bus);
+}
+
+gb *gb_create(void) {
+    gb *gb = malloc(sizeof(*gb));
+    if (gb == NULL) {
+        fprintf(stderr, "Failed to allocate memory for gb\n");
+        return NULL;
+    }
+    gb_init(gb);
+    return gb;
+}
+
+void gb_destroy(gb *gb) {
+    if (gb == NULL) {
+        return;
+    }
+    gb_free(gb);
+    free(gb);
+}
+
+// returns 0 on success, -1 if the rom couldn't be read
+int gb_load_rom(gb *gb, const char *rom_path) {
+    return load_rom(&gb->cpu.bus, rom_path);
+}
+
+int gb_copy(gb *dst, const gb *src) {
+    // the state is small enough for the stack even with cart ram
+    uint8_t state[gb_state_size(src)];
+    if (gb_save_state(src, state, sizeof(state)) == 0) {
+        return -1;
+    }
+    bus_share_rom(&dst->cpu.bus, src->cpu.bus.rom);
+    return gb_load_state(dst, state, sizeof(state));
+}
+
+gb *gb_clone(const gb *src) {
+    gb *gb = gb_create();
+    if (gb == NULL) {
+        return NULL;
+    }
+    if (gb_copy(gb, src) != 0) {
+        gb_destroy(gb);
+        return NULL;
+    }
+    return gb;
+}
+
+void gb_set_joypad(gb *gb, uint8_t buttons) {
+    // bus keeps them active low, dpad in the low nibble and buttons in the high one
+    bus_set_joypad(&gb->cpu.bus, ~buttons & 0x0F, (~buttons >> 4) & 0x0F);
+}
+
+bool gb_input_push(gb *gb, uint32_t cycle, uint8_t buttons) {
+    gb_input_queue *queue = &gb->input;
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == GB_INPUT_QUEUE_SIZE) {
+        return false;
+    }
+    queue->events[head % GB_INPUT_QUEUE_SIZE].cycle = cycle;
+    queue->events[head % GB_INPUT_QUEUE_SIZE].buttons = buttons;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t gb_input_clock(const gb *gb) {
+    return __atomic_load_n(&gb->input.clock, __ATOMIC_ACQUIRE);
+}
+
+// apply the next queued change if it's due, before the next instruction. running ahead the
+// event keeps its slot, so the real frames apply it again once the state is put back
+static inline void gb_input_poll(gb *gb) {
+    gb_input_queue *queue = &gb->input;
+    uint32_t next = queue->next;
+    if (next == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    gb_input_event event = queue->events[next % GB_INPUT_QUEUE_SIZE];
+    if ((int32_t)(gb->cpu.count - event.cycle) < 0) {
+        return;
+    }
+    queue->next = next + 1;
+    gb_set_joypad(gb, event.buttons);
+    if (queue->ahead) {
+        return;
+    }
+    __atomic_store_n(&queue->tail, next + 1, __ATOMIC_RELEASE);
+    if (queue->applied != NULL) {
+        queue->applied(queue->user, gb);
+    }
+}
+
+static inline void gb_input_publish_clock(gb *gb) {
+    if (!gb->input.ahead) {
+        __atomic_store_n(&gb->input.clock, gb->cpu.count, __ATOMIC_RELEASE);
+    }
+}
+
+void gb_step(gb *gb) {
+    gb_input_poll(gb);
+    cpu_step(&gb->cpu);
+}
+
+uint32_t gb_run_cycles(gb *gb, uint32_t cycles) {
+    uint32_t start = gb->cpu.count;
+    while (gb->cpu.count - start < cycles) {
+        gb_input_poll(gb);
+        cpu_step(&gb->cpu);
+    }
+    gb_input_publish_clock(gb);
+    return gb->cpu.count - start;
+}
+
+uint32_t gb_run_frame(gb *gb) {
+    uint32_t start = gb->cpu.count;
+    uint32_t frame = gb->ppu.frame_count;
+
+    while (gb->ppu.frame_count == frame) {
+        gb_input_poll(gb);
+        cpu_step(&gb->cpu);
+
+        // no vblank while the lcd is off, keep the frame rate going anyway
+        if (!gb->ppu.lcd_enabled && gb->cpu.count - start >= GB_CYCLES_PER_FRAME) {
+            break;
+        }
+    }
+    gb_input_publish_clock(gb);
+    return gb->cpu.count - start;
+}
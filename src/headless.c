@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/gb.h"
+#include "../include/shm_sink.h"
+#include "../include/state.h"
+#include "../include/movie.h"
+#include "../include/link.h"
+#include "../include/socket_link.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+// headless runner, links only libgbcore
+// runs a rom for a number of frames as fast as possible and prints stats,
+// optionally with a hash of every drawn frame for regression checks, or of the whole
+// machine after every frame for checking two runs against each other
+
+#define DEFAULT_FRAMES 600
+
+typedef struct headless_run {
+    bool print_hashes;
+    uint32_t frames_drawn;
+    uint64_t run_hash;      // hash over the hashes of every drawn frame
+} headless_run;
+
+static void headless_end_frame(void *user, uint8_t *buffer, void *pixels) {
+    (void)pixels;
+    headless_run *run = user;
+    uint64_t hash = gb_frame_hash(buffer);
+    if (run->print_hashes) {
+        printf("frame %u %016llx\n", run->frames_drawn, (unsigned long long)hash);
+    }
+    run->run_hash = (run->run_hash ^ hash) * GB_FNV_PRIME;
+    run->frames_drawn++;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s rom.gb [-n frames] [--hashes] [--state-hashes] [--render-thread] [--shm name]\n"
+                    "       [--resume state.bin] [--save-state state.bin] [--play movie.gbm] [--link other.gb]\n"
+                    "       [--link-listen socket] [--link-connect socket]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long frames = DEFAULT_FRAMES;
+    bool frames_set = false;
+    bool state_hashes = false;
+    bool render_thread = false;
+    const char *shm_name = NULL;
+    const char *resume_path = NULL;
+    const char *save_path = NULL;
+    const char *movie_path = NULL;
+    const char *link_path = NULL;
+    const char *socket_path = NULL;
+    bool socket_listen = false;
+    headless_run run = { false, 0, GB_FNV_OFFSET };
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            frames = atol(argv[++i]);
+            frames_set = true;
+        } else if (strcmp(argv[i], "--hashes") == 0) {
+            run.print_hashes = true;
+        } else if (strcmp(argv[i], "--state-hashes") == 0) {
+            state_hashes = true;
+        } else if (strcmp(argv[i], "--render-thread") == 0) {
+            render_thread = true;
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shm_name = argv[++i];
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            movie_path = argv[++i];
+        } else if (strcmp(argv[i], "--link") == 0 && i + 1 < argc) {
+            link_path = argv[++i];
+        } else if ((strcmp(argv[i], "--link-listen") == 0 || strcmp(argv[i], "--link-connect") == 0) && i + 1 < argc) {
+            socket_listen = strcmp(argv[i], "--link-listen") == 0;
+            socket_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    gb *gameboy = gb_create();
+    if (gameboy == NULL) {
+        return 1;
+    }
+    if (gb_load_rom(gameboy, argv[1]) != 0) {
+        fprintf(stderr, "failed to load ROM. exiting.\n");
+        gb_destroy(gameboy);
+        return 1;
+    }
+
+    // start from a snapshot instead of power on
+    if (resume_path != NULL && gb_load_state_file(gameboy, resume_path) != 0) {
+        gb_destroy(gameboy);
+        return 1;
+    }
+
+    // play a movie to its end, -n still caps the frames
+    gb_movie *movie = NULL;
+    if (movie_path != NULL) {
+        movie = gb_movie_load(movie_path);
+        if (movie == NULL || gb_movie_play(movie, gameboy) != 0) {
+            gb_movie_destroy(movie);
+            gb_destroy(gameboy);
+            return 1;
+        }
+        if (!frames_set) {
+            frames = LONG_MAX;
+        }
+    }
+
+    // a second machine on the other end of a link cable, run in step with the first but
+    // not drawn or hashed
+    gb *other = NULL;
+    gb_link link;
+    if (link_path != NULL) {
+        if (movie != NULL) {
+            fprintf(stderr, "--link can't be used with --play\n");
+            gb_movie_destroy(movie);
+            gb_destroy(gameboy);
+            return 1;
+        }
+        other = gb_create();
+        if (other == NULL || gb_load_rom(other, link_path) != 0) {
+            fprintf(stderr, "failed to load ROM. exiting.\n");
+            gb_destroy(other);
+            gb_destroy(gameboy);
+            return 1;
+        }
+        gb_link_connect(&link, gameboy, other);
+    }
+
+    // the other end of the cable is another process, on a unix socket
+    gb_socket_link *socket_link = NULL;
+    if (socket_path != NULL) {
+        if (movie != NULL || other != NULL) {
+            fprintf(stderr, "--link-listen and --link-connect can't be used with --play or --link\n");
+            gb_movie_destroy(movie);
+            if (other != NULL) {
+                gb_link_disconnect(&link);
+                gb_destroy(other);
+            }
+            gb_destroy(gameboy);
+            return 1;
+        }
+        socket_link = socket_listen ? gb_socket_link_listen(gameboy, socket_path)
+                                    : gb_socket_link_connect(gameboy, socket_path);
+        if (socket_link == NULL) {
+            gb_destroy(gameboy);
+            return 1;
+        }
+    }
+
+    // palette indices only, no pixel conversion
+    ppu_output_sink sink = {0};
+    sink.user = &run;
+    sink.end_frame = headless_end_frame;
+    ppu_set_output_sink(&gameboy->ppu, &sink);
+
+    // publish frames to other processes instead of hashing them
+    shm_sink *shm = NULL;
+    if (shm_name != NULL) {
+        if (render_thread) {
+            fprintf(stderr, "--shm draws frames inline, it can't be used with --render-thread\n");
+            gb_destroy(gameboy);
+            return 1;
+        }
+        shm = shm_sink_create(shm_name, gameboy);
+        if (shm == NULL) {
+            gb_destroy(gameboy);
+            return 1;
+        }
+    }
+
+    if (render_thread && ppu_start_render_thread(&gameboy->ppu) < 0) {
+        fprintf(stderr, "failed to start render thread, rendering inline\n");
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t cycles = 0;
+    long frames_run = 0;
+    if (movie != NULL) {
+        while (frames_run < frames && !gb_movie_finished(movie)) {
+            cycles += gb_movie_run_frame(movie, gameboy);
+            if (state_hashes) {
+                printf("state %ld %016llx\n", frames_run, (unsigned long long)gb_state_hash(gameboy));
+            }
+            frames_run++;
+        }
+    } else if (socket_link != NULL) {
+        // a rollback can still change frames already run, the last hash is after both sides
+        // have caught up
+        for (; frames_run < frames; frames_run++) {
+            gb_socket_link_run_frame(socket_link);
+            if (frames_run == frames - 1) {
+                gb_socket_link_settle(socket_link);
+            }
+            cycles = socket_link->time;
+            if (state_hashes) {
+                printf("state %ld %016llx\n", frames_run, (unsigned long long)gb_state_hash(gameboy));
+            }
+        }
+    } else {
+        for (; frames_run < frames; frames_run++) {
+            cycles += other != NULL ? gb_link_run_frame(&link) : gb_run_frame(gameboy);
+            if (state_hashes) {
+                printf("state %ld %016llx\n", frames_run, (unsigned long long)gb_state_hash(gameboy));
+            }
+        }
+    }
+    ppu_wait_render(&gameboy->ppu);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int result = 0;
+    if (save_path != NULL && gb_save_state_file(gameboy, save_path) != 0) {
+        result = 1;
+    }
+
+    if (shm != NULL) {
+        run.frames_drawn = shm->frame;
+        shm_sink_destroy(shm);
+    }
+    gb_movie_destroy(movie);
+    if (other != NULL) {
+        gb_link_disconnect(&link);
+        gb_destroy(other);
+    }
+    uint64_t socket_transfers = 0;
+    uint64_t rollbacks = 0;
+    uint64_t replayed = 0;
+    if (socket_link != NULL) {
+        socket_transfers = gb_socket_link_transfers(socket_link);
+        rollbacks = socket_link->rollbacks;
+        replayed = socket_link->replayed;
+        gb_socket_link_destroy(socket_link);
+    }
+    gb_destroy(gameboy);
+
+    printf("frames: %ld (%u drawn)\n", frames_run, run.frames_drawn);
+    printf("cycles: %llu\n", (unsigned long long)cycles);
+    printf("time: %.3f s\n", seconds);
+    printf("fps: %.1f (%.1fx real time)\n", frames_run / seconds, cycles / seconds / 4194304.0);
+    if (other != NULL) {
+        printf("link: %llu bytes\n", (unsigned long long)link.transfers);
+    }
+    if (socket_path != NULL) {
+        printf("link: %llu bytes, %llu rollbacks, %llu cycles run again\n", (unsigned long long)socket_transfers,
+               (unsigned long long)rollbacks, (unsigned long long)replayed);
+    }
+    if (shm_name == NULL) {
+        printf("hash: %016llx\n", (unsigned long long)run.run_hash);
+    }
+    return result;
+}
@@ -8,7 +8,7 @@ void instruction_execute(cpu *cpu, uint8_t opcode) {
     int16_t sn;
     uint32_t result;
 
-    uint8_t cb_op_tcycles[0x100] = {
+    static const uint8_t cb_op_tcycles[0x100] = {
         //   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
         8, 8, 8, 8, 8, 8,16, 8, 8, 8, 8, 8, 8, 8,16, 8,    // 0x00
         8, 8, 8, 8, 8, 8,16, 8, 8, 8, 8, 8, 8, 8,16, 8,    // 0x10
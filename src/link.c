@@ -0,0 +1,94 @@
+#include "../include/link.h"
+#include "../include/cpu.h"
+#include "../include/bus.h"
+#include <string.h>
+
+void gb_link_connect(gb_link *link, gb *a, gb *b) {
+    memset(link, 0, sizeof(*link));
+    link->gb[0] = a;
+    link->gb[1] = b;
+    link->base[0] = a->cpu.count;
+    link->base[1] = b->cpu.count;
+    a->cpu.bus.serial_linked = true;
+    b->cpu.bus.serial_linked = true;
+}
+
+void gb_link_disconnect(gb_link *link) {
+    for (int side = 0; side < 2; side++) {
+        bus *bus = &link->gb[side]->cpu.bus;
+        bus->serial_linked = false;
+        if (bus->serial_due) {
+            bus_serial_complete(bus, 0xFF);
+        }
+    }
+}
+
+// cycles since the cable went in, the two sides' cpu counts don't have to agree
+static inline uint32_t gb_link_time(const gb_link *link, int side) {
+    return link->gb[side]->cpu.count - link->base[side];
+}
+
+// how far a side can run before the other could reach it: a transfer running on the other
+// side lands when it ends, one it starts lands a byte time later at the earliest
+static inline uint32_t gb_link_horizon(const gb_link *link, int side) {
+    const bus *peer = &link->gb[!side]->cpu.bus;
+    uint32_t time = gb_link_time(link, !side);
+    if (peer->serial_cycles > 0 || peer->serial_due) {
+        return time + peer->serial_cycles;
+    }
+    return time + SERIAL_TRANSFER_CYCLES;
+}
+
+// side's transfer has finished and the other side has caught up to it, swap the bytes
+static void gb_link_exchange(gb_link *link, int side) {
+    bus *sender = &link->gb[side]->cpu.bus;
+    bus *peer = &link->gb[!side]->cpu.bus;
+    uint8_t received = 0xFF;
+
+    // the other side only shifts when it's listening on our clock
+    if ((peer->memory[0xFF02] & 0x81) == 0x80) {
+        received = peer->memory[0xFF01];
+        bus_serial_complete(peer, sender->memory[0xFF01]);
+    }
+    bus_serial_complete(sender, received);
+    link->transfers++;
+}
+
+// same end of frame as gb_run_frame, no vblank while the lcd is off
+static inline bool gb_link_frame_done(const gb *gb, uint32_t frame, uint32_t start) {
+    return gb->ppu.frame_count != frame ||
+           (!gb->ppu.lcd_enabled && gb->cpu.count - start >= GB_CYCLES_PER_FRAME);
+}
+
+uint32_t gb_link_run_frame(gb_link *link) {
+    gb *first = link->gb[0];
+    uint32_t start = first->cpu.count;
+    uint32_t frame = first->ppu.frame_count;
+
+    for (;;) {
+        // a finished transfer goes through once the other side has got to the same cycle
+        for (int side = 0; side < 2; side++) {
+            if (link->gb[side]->cpu.bus.serial_due &&
+                (int32_t)(gb_link_time(link, !side) - gb_link_time(link, side)) >= 0) {
+                gb_link_exchange(link, side);
+            }
+        }
+        if (gb_link_frame_done(first, frame, start)) {
+            break;
+        }
+
+        // whichever side is behind runs, until it could hear from the other or its own
+        // transfer finishes
+        int side = (int32_t)(gb_link_time(link, 1) - gb_link_time(link, 0)) < 0;
+        gb *gb = link->gb[side];
+        uint32_t until = gb_link_horizon(link, side);
+        while ((int32_t)(gb_link_time(link, side) - until) < 0 && !gb->cpu.bus.serial_due) {
+            gb_step(gb);
+            if (side == 0 && gb_link_frame_done(first, frame, start)) {
+                break;
+            }
+        }
+    }
+    __atomic_store_n(&first->input.clock, first->cpu.count, __ATOMIC_RELEASE);
+    return first->cpu.count - start;
+}
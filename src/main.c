@@ -1,20 +1,89 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../include/cpu.h"
 #include "../include/bus.h"
 #include "../include/ppu.h"
+#include "../include/gb.h"
+#include "../include/pacer.h"
+#include "../include/rewind.h"
+#include "../include/state.h"
+#include "../include/movie.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <SDL2/SDL.h>
 
-// global SDL variables
-SDL_Window *window = NULL;
-SDL_Renderer *renderer = NULL;
-SDL_Texture *screen_texture = NULL;
+// lock-free triple buffer of finished frames
+// the renderer owns back, the presenter owns front, and they swap through middle
+#define TRIPLE_BUFFER_FRESH 0x4     // set in middle when it holds a frame not yet presented
+
+typedef struct triple_buffer {
+    uint32_t pixels[3][SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t back;
+    uint8_t front;
+    uint8_t middle;     // swapped atomically, index | TRIPLE_BUFFER_FRESH
+} triple_buffer;
+
+// joypad state as the input handler builds it, forwarded to the emulation thread
+// active low like the bus. the select bits belong to the game, the frontend never sets them
+typedef struct joypad_input {
+    uint8_t dpad_state;
+    uint8_t button_state;
+} joypad_input;
+
+#define DEFAULT_FRAME_SKIP 4
+#define DEFAULT_REWIND_MB 4
+#define REWIND_INTERVAL 2           // frames between rewind states, so rewinding runs at 2x
+
+// everything the frontend needs, passed to each function and thread instead of globals
+// emulation runs on its own thread and paces itself to the guest refresh rate
+// the main thread only presents the newest finished frame and forwards input
+typedef struct frontend {
+    gb *gameboy;
+
+    // sdl, main thread only
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *screen_texture;
+
+    triple_buffer frames;       // render side -> main thread
+
+    int input_pending;          // a change didn't fit in the input queue, retry it
+    int input_slices;           // times per frame the emulation thread catches up, --slices n
+    int running;
+
+    // pacing, --speed n runs at n times real time (0 for uncapped) and --frameskip n
+    // allows up to n frames in a row to go undrawn when the host can't keep up
+    pacer pacer;
+    pacer_mode pace_mode;
+    double pace_speed;
+    int fast_forward;           // tab held, set by the main thread
+
+    // rewind history, --rewind n keeps n MB of it (0 for none)
+    gb_rewind *rewind;          // emulation thread only
+    int rewinding;              // backspace held, set by the main thread
+
+    // --runahead n shows the frame n frames ahead of the machine, so input shows up sooner
+    uint32_t run_ahead;
+    uint8_t *run_ahead_state;   // scratch save state
+    size_t run_ahead_size;
+
+    // --record file.gbm, input movie from power on, emulation thread only
+    gb_movie *movie;
+    const char *movie_path;
+
+    FILE *log_file;             // --log
+} frontend;
 
-FILE *log_file = NULL;
 #define MAX_CYCLES 10000000
 
-void debug_print(cpu *gameboy) {
+// cpu trace in gameboy doctor format, only when started with --log
+void debug_print(FILE *log_file, cpu *gameboy) {
+    if (log_file == NULL) {
+        return;
+    }
     fprintf(log_file, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
            gameboy->registers.a,
            flags_register_to_byte(gameboy->registers.f),
@@ -32,15 +101,28 @@ void debug_print(cpu *gameboy) {
            bus_read8(&gameboy->bus, gameboy->registers.pc + 3));
 }
 
+// a frame one instruction at a time, traced before each one. ends like gb_run_frame, and
+// gb_run_cycles keeps the input clock going
+static uint32_t run_frame_logged(frontend *frontend, gb *gameboy) {
+    uint32_t start = gameboy->cpu.count;
+    uint32_t frame = gameboy->ppu.frame_count;
+    while (gameboy->ppu.frame_count == frame &&
+           (gameboy->ppu.lcd_enabled || gameboy->cpu.count - start < GB_CYCLES_PER_FRAME)) {
+        debug_print(frontend->log_file, &gameboy->cpu);
+        gb_run_cycles(gameboy, 1);
+    }
+    return gameboy->cpu.count - start;
+}
+
 // initialize SDL and create window/renderer
-int init_display() {
+int init_display(frontend *frontend) {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         fprintf(stderr, "failed to initialize sdl2: %s\n", SDL_GetError());
         return -1;
     }
 
     // create window (scaled up by 4 for visibility)
-    window = SDL_CreateWindow(
+    frontend->window = SDL_CreateWindow(
         "gameboy emulator",
         SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED,
@@ -49,37 +131,37 @@ int init_display() {
         SDL_WINDOW_SHOWN
     );
 
-    if (!window) {
+    if (!frontend->window) {
         fprintf(stderr, "failed to create window: %s\n", SDL_GetError());
         return -1;
     }
 
     // create renderer
-    renderer = SDL_CreateRenderer(
-        window,
+    frontend->renderer = SDL_CreateRenderer(
+        frontend->window,
         -1,
         SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
     );
 
-    if (!renderer) {
+    if (!frontend->renderer) {
         fprintf(stderr, "failed to create renderer: %s\n", SDL_GetError());
         return -1;
     }
 
     // set scaling quality
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
-    SDL_RenderSetLogicalSize(renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+    SDL_RenderSetLogicalSize(frontend->renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
 
     // create texture for screen buffer
-    screen_texture = SDL_CreateTexture(
-        renderer,
+    frontend->screen_texture = SDL_CreateTexture(
+        frontend->renderer,
         SDL_PIXELFORMAT_RGBA8888,
         SDL_TEXTUREACCESS_STREAMING,
         SCREEN_WIDTH,
         SCREEN_HEIGHT
     );
 
-    if (!screen_texture) {
+    if (!frontend->screen_texture) {
         fprintf(stderr, "failed to create texture: %s\n", SDL_GetError());
         return -1;
     }
@@ -88,126 +170,167 @@ int init_display() {
 }
 
 // cleanup SDL resources
-void cleanup_display() {
-    if (screen_texture) {
-        SDL_DestroyTexture(screen_texture);
+void cleanup_display(frontend *frontend) {
+    if (frontend->screen_texture) {
+        SDL_DestroyTexture(frontend->screen_texture);
     }
-    if (renderer) {
-        SDL_DestroyRenderer(renderer);
+    if (frontend->renderer) {
+        SDL_DestroyRenderer(frontend->renderer);
     }
-    if (window) {
-        SDL_DestroyWindow(window);
+    if (frontend->window) {
+        SDL_DestroyWindow(frontend->window);
     }
     SDL_Quit();
 }
 
 // convert gameboy colors to SDL colors
-uint32_t gb_colors[4] = {
+static const uint32_t gb_colors[4] = {
     0xE0F8D0FF,  // lightest green
     0x88C070FF,  // light green  
     0x346856FF,  // dark green
     0x081820FF   // darkest green/black
 };
 
-// callback function for PPU frame completion
-void display_frame(uint8_t *buffer) {
-    uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
-    
-    // add debug print
-    // printf("Display frame called, first few pixels: %d %d %d %d\n", 
-    //        buffer[0], buffer[1], buffer[2], buffer[3]);
-    
-    // convert gameboy palette to RGBA
-    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
-        pixels[i] = gb_colors[buffer[i]];
+// producer side, called from the renderer
+// returns the back buffer for the next frame
+uint32_t *triple_buffer_write(triple_buffer *buffers) {
+    return buffers->pixels[buffers->back];
+}
+
+// publish the back buffer and take the old middle one as the new back buffer
+void triple_buffer_publish(triple_buffer *buffers) {
+    uint8_t old = __atomic_exchange_n(&buffers->middle, buffers->back | TRIPLE_BUFFER_FRESH, __ATOMIC_ACQ_REL);
+    buffers->back = old & 0x3;
+}
+
+// consumer side, returns the newest frame or NULL if nothing new was published
+uint32_t *triple_buffer_read(triple_buffer *buffers) {
+    if (!(__atomic_load_n(&buffers->middle, __ATOMIC_ACQUIRE) & TRIPLE_BUFFER_FRESH)) {
+        return NULL;
+    }
+    uint8_t old = __atomic_exchange_n(&buffers->middle, buffers->front, __ATOMIC_ACQ_REL);
+    buffers->front = old & 0x3;
+    return buffers->pixels[buffers->front];
+}
+
+// output sink for the PPU
+// the PPU writes RGBA straight into the triple buffer's back buffer
+void *display_begin_frame(void *user, int *pitch) {
+    triple_buffer *buffers = user;
+    *pitch = SCREEN_WIDTH * sizeof(uint32_t);
+    return triple_buffer_write(buffers);
+}
+
+void display_end_frame(void *user, uint8_t *buffer, void *pixels) {
+    (void)buffer;
+    (void)pixels;
+    triple_buffer_publish((triple_buffer *)user);
+}
+
+// present the newest frame, called on the main thread
+// returns 0 if there was nothing new to show
+int display_present(frontend *frontend) {
+    uint32_t *pixels = triple_buffer_read(&frontend->frames);
+    if (pixels == NULL) {
+        return 0;
     }
 
     // update texture with new frame
-    SDL_UpdateTexture(screen_texture, NULL, pixels, SCREEN_WIDTH * sizeof(uint32_t));
+    SDL_UpdateTexture(frontend->screen_texture, NULL, pixels, SCREEN_WIDTH * sizeof(uint32_t));
     
     // clear renderer and draw new frame
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    SDL_RenderClear(frontend->renderer);
+    SDL_RenderCopy(frontend->renderer, frontend->screen_texture, NULL, NULL);
+    SDL_RenderPresent(frontend->renderer);
+    return 1;
 }
 
 // event handler for main
 // based on the button selected, set the corresponding bit (to 0)
-void handle_input(SDL_Event *event, bus *bus) {
+// runs on the main thread, the result is forwarded with publish_input
+// returns 1 if the joypad changed, hotkeys go straight to the emulation thread
+int handle_input(frontend *frontend, SDL_Event *event, joypad_input *input) {
+    if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) {
+        return 0;
+    }
+
+    // tab fast forwards and backspace rewinds while held, they aren't joypad keys
+    int down = event->type == SDL_KEYDOWN;
+    switch (event->key.keysym.sym) {
+        case SDLK_TAB:
+            __atomic_store_n(&frontend->fast_forward, down, __ATOMIC_RELEASE);
+            return 0;
+        case SDLK_BACKSPACE:
+            __atomic_store_n(&frontend->rewinding, down, __ATOMIC_RELEASE);
+            return 0;
+    }
+
     switch(event->type) {
         case SDL_KEYDOWN:
             switch(event->key.keysym.sym) {
               // dpad
                 case SDLK_RIGHT:
-                    bus->joypad_select &= ~0x10;  // clear bit 4 for dpad
-                    bus->dpad_state &= ~0x01;
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->dpad_state &= ~0x01;
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 case SDLK_LEFT:
-                    bus->joypad_select &= ~0x10;
-                    bus->dpad_state &= ~0x02;
-                    // printf("left press: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->dpad_state &= ~0x02;
+                    // printf("left press: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 case SDLK_UP:
-                    bus->joypad_select &= ~0x10;
-                    bus->dpad_state &= ~0x04;
-                    // printf("up press: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->dpad_state &= ~0x04;
+                    // printf("up press: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 case SDLK_DOWN:
-                    bus->joypad_select &= ~0x10;
-                    bus->dpad_state &= ~0x08;
-                    // printf("down press: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->dpad_state &= ~0x08;
+                    // printf("down press: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
 
                 // buttons
                 case SDLK_a:  // A button
-                    bus->joypad_select &= ~0x20;  // clear bit 5 for buttons
-                    bus->button_state &= ~0x01;
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->button_state &= ~0x01;
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 case SDLK_s:  // B button 
-                    bus->joypad_select &= ~0x20;
-                    bus->button_state &= ~0x02;
-                    // printf("b press: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->button_state &= ~0x02;
+                    // printf("b press: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 case SDLK_q:  // select
-                    bus->joypad_select &= ~0x20;
-                    bus->button_state &= ~0x04;
-                    // printf("select press: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->button_state &= ~0x04;
+                    // printf("select press: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 case SDLK_w:  // start
-                    bus->joypad_select &= ~0x20;
-                    bus->button_state &= ~0x08;
-                    // printf("start press: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
-                    // print_bits(bus->joypad_select, "select bits");
-                    // print_bits(bus->button_state, "button state");
-                    // print_bits(bus->dpad_state, "dpad state");
+                    input->button_state &= ~0x08;
+                    // printf("start press: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
+                    // print_bits(input->joypad_select, "select bits");
+                    // print_bits(input->button_state, "button state");
+                    // print_bits(input->dpad_state, "dpad state");
                     // printf("---\n");
                     break;
                 }
@@ -217,70 +340,155 @@ void handle_input(SDL_Event *event, bus *bus) {
           switch(event->key.keysym.sym) {
                 // dpad releases
                 case SDLK_RIGHT:
-                    bus->dpad_state |= 0x01;
-                    //printf("right release: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
+                    input->dpad_state |= 0x01;
+                    //printf("right release: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
                     break;
                 case SDLK_LEFT:
-                    bus->dpad_state |= 0x02;
-                    //printf("left release: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
+                    input->dpad_state |= 0x02;
+                    //printf("left release: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
                     break;
                 case SDLK_UP:
-                    bus->dpad_state |= 0x04;
-                    //printf("up release: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
+                    input->dpad_state |= 0x04;
+                    //printf("up release: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
                     break;
                 case SDLK_DOWN:
-                    bus->dpad_state |= 0x08;
-                    //printf("down release: select=%02X dpad_state=%02X\n", bus->joypad_select, bus->dpad_state);
+                    input->dpad_state |= 0x08;
+                    //printf("down release: select=%02X dpad_state=%02X\n", input->joypad_select, input->dpad_state);
                     break;
 
                 // button releases    
                 case SDLK_a:
-                    bus->button_state |= 0x01;
-                    //printf("a release: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
+                    input->button_state |= 0x01;
+                    //printf("a release: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
                     break;
                 case SDLK_s:
-                    bus->button_state |= 0x02;
-                    //printf("b release: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
+                    input->button_state |= 0x02;
+                    //printf("b release: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
                     break;
                 case SDLK_q:
-                    bus->button_state |= 0x04;
-                    //printf("select release: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
+                    input->button_state |= 0x04;
+                    //printf("select release: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
                     break;
                 case SDLK_w:
-                    bus->button_state |= 0x08;
-                    //printf("start release: select=%02X button_state=%02X\n", bus->joypad_select, bus->button_state);
+                    input->button_state |= 0x08;
+                    //printf("start release: select=%02X button_state=%02X\n", input->joypad_select, input->button_state);
                     break;
           }
-          
-          bus->joypad_select |= 0x30;  // set bits 4-5 (nothing selected)
           break;
   }
+  return 1;
 }
 
-int main(int argc, char *argv[]) {
-    cpu gameboy;
-    ppu PPU;
-    memset(&gameboy, 0, sizeof(cpu));
+// hand the joypad state to the emulation thread through the gb's input queue
+// stamped with the emulation clock, so it's applied before the next instruction that runs
+// returns 0 if the queue was full
+int publish_input(frontend *frontend, joypad_input *input) {
+    gb *gameboy = frontend->gameboy;
+    uint8_t buttons = (~input->dpad_state & 0x0F) | ((~input->button_state & 0x0F) << 4);
+    return gb_input_push(gameboy, gb_input_clock(gameboy), buttons) ? 1 : 0;
+}
+
+// movie recording, called on the emulation thread right after a queued change is applied
+static void record_input(void *user, gb *gameboy) {
+    gb_movie_sample((gb_movie *)user, gameboy);
+}
 
-    // init everything
-    bus_init(&gameboy.bus);
-    cpu_init(&gameboy, &PPU);  // pass in the PPU pointer
+// emulation thread
+// runs a frame (or a slice of one) at a time, picks up input in between and
+// lets the pacer sleep until host time catches up with the emulated cycles
+void *emulation_thread(void *arg) {
+    frontend *frontend = arg;
+    gb *gameboy = frontend->gameboy;
+    uint32_t slice = GB_CYCLES_PER_FRAME / frontend->input_slices;
+    uint32_t frame = gameboy->ppu.frame_count;
+    int turbo = 0;
+
+    while (__atomic_load_n(&frontend->running, __ATOMIC_ACQUIRE)) {
+        // keeps the movie clock going between input changes
+        if (frontend->movie != NULL) {
+            gb_movie_sample(frontend->movie, gameboy);
+        }
 
-    // calls test init, setting to the DMG defaults for boot
-    cpu_init_test(&gameboy.registers);
+        // uncapped while the fast forward key is held
+        int held = __atomic_load_n(&frontend->fast_forward, __ATOMIC_ACQUIRE);
+        if (held != turbo) {
+            turbo = held;
+            pacer_set_mode(&frontend->pacer, turbo ? PACER_TURBO : frontend->pace_mode, frontend->pace_speed);
+        }
 
-    // setup PPU
-    ppu_set_frame_callback(&PPU, display_frame);
-    ppu_init(&PPU, &gameboy.bus);
-    printf("callback set: %s\n", PPU.frame_complete_callback != NULL ? "yes" : "no");
-    // ppu_init(&PPU, &gameboy.bus);
+        // step back one rewind state per frame shown, then draw the frame that follows it
+        if (frontend->rewind != NULL && __atomic_load_n(&frontend->rewinding, __ATOMIC_ACQUIRE) &&
+            gb_rewind_pop(frontend->rewind, gameboy) == 0) {
+            gameboy->ppu.skip_frame = false;
+            uint32_t cycles = gb_run_frame(gameboy);
+            frame = gameboy->ppu.frame_count;
+            pacer_wait(&frontend->pacer, cycles);
+            continue;
+        }
 
-    // open log file
-    log_file = fopen("logfile.txt", "w");
-    if (log_file == NULL) {
-        fprintf(stderr, "Failed to open log file. Exiting.\n");
+        // the trace is of the real machine, so no run-ahead or slices while logging
+        uint32_t cycles;
+        if (frontend->log_file != NULL) {
+            cycles = run_frame_logged(frontend, gameboy);
+        } else if (frontend->run_ahead > 0) {
+            cycles = gb_run_frame_ahead(gameboy, frontend->run_ahead, frontend->run_ahead_state, frontend->run_ahead_size);
+        } else if (frontend->input_slices > 1) {
+            cycles = gb_run_cycles(gameboy, slice);
+        } else {
+            cycles = gb_run_frame(gameboy);
+        }
+
+        // decide at each frame boundary whether the next one gets drawn
+        if (gameboy->ppu.frame_count != frame) {
+            frame = gameboy->ppu.frame_count;
+            gameboy->ppu.skip_frame = pacer_skip_frame(&frontend->pacer);
+            if (frontend->rewind != NULL) {
+                gb_rewind_frame(frontend->rewind, gameboy);
+            }
+        }
+
+        pacer_wait(&frontend->pacer, cycles);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int frame_skip = DEFAULT_FRAME_SKIP;
+    double rewind_mb = DEFAULT_REWIND_MB;
+
+    // the triple buffer alone is a few hundred KB, keep it off the stack
+    frontend *frontend = calloc(1, sizeof(*frontend));
+    if (frontend == NULL) {
+        fprintf(stderr, "Failed to allocate memory for frontend\n");
         return 1;
     }
+    frontend->frames.back = 0;
+    frontend->frames.middle = 1;
+    frontend->frames.front = 2;
+    frontend->input_slices = 1;
+    frontend->running = 1;
+    frontend->pace_mode = PACER_REALTIME;
+    frontend->pace_speed = 1.0;
+
+    // init everything, registers start at the DMG defaults for boot
+    gb *gameboy = gb_create();
+    if (gameboy == NULL) {
+        return 1;
+    }
+    frontend->gameboy = gameboy;
+
+    ppu_output_sink sink = {0};
+    sink.user = &frontend->frames;
+    sink.begin_frame = display_begin_frame;
+    sink.end_frame = display_end_frame;
+    sink.bytes_per_pixel = sizeof(uint32_t);
+    memcpy(sink.palette, gb_colors, sizeof(gb_colors));
+    ppu_set_output_sink(&gameboy->ppu, &sink);
+
+    // frames are drawn off the emulation thread, the sink only touches the triple buffer
+    if (ppu_start_render_thread(&gameboy->ppu) < 0) {
+        fprintf(stderr, "failed to start render thread, rendering inline\n");
+    }
 
     // load rom 
     if (argc < 2) {
@@ -288,8 +496,43 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--slices") == 0 && i + 1 < argc) {
+            frontend->input_slices = atoi(argv[++i]);
+            if (frontend->input_slices < 1) {
+                frontend->input_slices = 1;
+            }
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            frontend->pace_speed = atof(argv[++i]);
+            if (frontend->pace_speed <= 0) {
+                frontend->pace_mode = PACER_TURBO;
+            } else if (frontend->pace_speed != 1.0) {
+                frontend->pace_mode = PACER_SPEED;
+            }
+        } else if (strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc) {
+            frame_skip = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind_mb = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--runahead") == 0 && i + 1 < argc) {
+            int frames = atoi(argv[++i]);
+            frontend->run_ahead = frames < 0 ? 0 : frames;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            frontend->movie_path = argv[++i];
+        } else if (strcmp(argv[i], "--log") == 0) {
+            // cpu trace for debugging, off by default
+            frontend->log_file = fopen("logfile.txt", "w");
+            if (frontend->log_file == NULL) {
+                fprintf(stderr, "Failed to open log file. Exiting.\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
     const char *rom_path = argv[1];
-    if (load_rom(&gameboy.bus, rom_path) == 0) {
+    if (gb_load_rom(gameboy, rom_path) == 0) {
         
     } 
     
@@ -298,36 +541,94 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // run-ahead works a whole frame at a time, input is picked up between frames
+    if (frontend->run_ahead > 0) {
+        frontend->input_slices = 1;
+        frontend->run_ahead_size = gb_state_size(gameboy);
+        frontend->run_ahead_state = malloc(frontend->run_ahead_size);
+        if (frontend->run_ahead_state == NULL) {
+            fprintf(stderr, "Failed to allocate memory for run-ahead\n");
+            return 1;
+        }
+    }
+
+    // a movie is one timeline, rewinding would break it. run-ahead doesn't, the input queue
+    // only reports changes the real frames apply and the movie is sampled between frames
+    if (frontend->movie_path != NULL) {
+        frontend->movie = gb_movie_record(gameboy, false);
+        if (frontend->movie == NULL) {
+            return 1;
+        }
+        gameboy->input.applied = record_input;
+        gameboy->input.user = frontend->movie;
+        rewind_mb = 0;
+    }
+
+    if (rewind_mb > 0) {
+        frontend->rewind = gb_rewind_create(gameboy, (size_t)(rewind_mb * 1024 * 1024), REWIND_INTERVAL);
+        if (frontend->rewind == NULL) {
+            return 1;
+        }
+    }
+
     // initialize SDL display
-    if (init_display() < 0) {
+    if (init_display(frontend) < 0) {
         fprintf(stderr, "display initialization failed\n");
         return 1;
     }
 
-    // game loop
+    // start emulation
+    joypad_input input = { gameboy->cpu.bus.dpad_state, gameboy->cpu.bus.button_state };
+    pacer_init(&frontend->pacer, frontend->pace_mode, frontend->pace_speed);
+    frontend->pacer.max_frame_skip = frame_skip < 0 ? 0 : frame_skip > 255 ? 255 : frame_skip;
+    pthread_t emulation;
+    if (pthread_create(&emulation, NULL, emulation_thread, frontend) != 0) {
+        fprintf(stderr, "failed to start emulation thread\n");
+        return 1;
+    }
+
+    // present loop
     SDL_Event event;
-    int running = 1;
     
-    while (running) {
+    while (frontend->running) {
         // handle SDL events
+        int input_changed = 0;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
-                running = 0;
+                __atomic_store_n(&frontend->running, 0, __ATOMIC_RELEASE);
             }
             // call handler for SDL inputs
-            handle_input(&event, &gameboy.bus);
+            if (handle_input(frontend, &event, &input)) {
+                input_changed = 1;
+            }
+        }
+        if (input_changed || frontend->input_pending) {
+            frontend->input_pending = !publish_input(frontend, &input);
+        }
+
+        // present blocks on vsync, when no new frame is ready yet just wait a bit
+        if (!display_present(frontend)) {
+            SDL_Delay(1);
         }
-        // debug_print(&gameboy);
-        
-        cpu_step(&gameboy);
-        // ppu_step(&PPU);
-        
+    }
+
+    pthread_join(emulation, NULL);
+
+    if (frontend->movie != NULL) {
+        gb_movie_stop(frontend->movie, gameboy);
+        gb_movie_save(frontend->movie, frontend->movie_path);
+        gb_movie_destroy(frontend->movie);
     }
 
     // cleanup
-    cleanup_display();
-    bus_free(&gameboy.bus);
-    fclose(log_file);
+    cleanup_display(frontend);
+    gb_rewind_destroy(frontend->rewind);
+    free(frontend->run_ahead_state);
+    gb_destroy(gameboy);
+    if (frontend->log_file != NULL) {
+        fclose(frontend->log_file);
+    }
+    free(frontend);
     return 0;
 }
 
@@ -0,0 +1,299 @@
+#include "../include/movie.h"
+#include "../include/state.h"
+#include "../include/cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t start_buttons;
+    uint8_t reserved;
+    uint8_t rom_check[4];
+    uint32_t start_state_size;  // 0 for power on
+    uint64_t length;            // cycles
+    uint64_t events_size;       // bytes
+} gb_movie_header;
+
+// joypad as GB_BUTTON_* bits, the bus keeps it active low
+static uint8_t gb_movie_buttons(const gb *gb) {
+    return (~gb->cpu.bus.dpad_state & 0x0F) | ((~gb->cpu.bus.button_state & 0x0F) << 4);
+}
+
+// bring elapsed up to the cpu, the count is 32 bits so this has to run every so often
+static inline void gb_movie_advance(gb_movie *movie, const gb *gb) {
+    movie->elapsed += (uint32_t)(gb->cpu.count - movie->last_count);
+    movie->last_count = gb->cpu.count;
+}
+
+static int gb_movie_reserve(gb_movie *movie, size_t bytes) {
+    if (movie->size + bytes <= movie->capacity) {
+        return 0;
+    }
+    size_t capacity = movie->capacity > 0 ? movie->capacity * 2 : 4096;
+    while (capacity < movie->size + bytes) {
+        capacity *= 2;
+    }
+    uint8_t *events = realloc(movie->events, capacity);
+    if (events == NULL) {
+        fprintf(stderr, "Failed to allocate memory for movie\n");
+        return -1;
+    }
+    movie->events = events;
+    movie->capacity = capacity;
+    return 0;
+}
+
+gb_movie *gb_movie_record(const gb *gb, bool from_state) {
+    gb_movie *movie = calloc(1, sizeof(gb_movie));
+    if (movie == NULL) {
+        fprintf(stderr, "Failed to allocate memory for movie\n");
+        return NULL;
+    }
+    if (from_state) {
+        movie->start_state_size = gb_state_size(gb);
+        movie->start_state = malloc(movie->start_state_size);
+        if (movie->start_state == NULL) {
+            fprintf(stderr, "Failed to allocate memory for movie\n");
+            free(movie);
+            return NULL;
+        }
+        gb_save_state(gb, movie->start_state, movie->start_state_size);
+    }
+    gb_state_rom_check(gb, movie->rom_check);
+    movie->start_buttons = gb_movie_buttons(gb);
+    movie->buttons = movie->start_buttons;
+    movie->last_count = gb->cpu.count;
+    movie->recording = true;
+    return movie;
+}
+
+void gb_movie_sample(gb_movie *movie, const gb *gb) {
+    if (!movie->recording) {
+        return;
+    }
+    gb_movie_advance(movie, gb);
+
+    uint8_t buttons = gb_movie_buttons(gb);
+    if (buttons == movie->buttons) {
+        return;
+    }
+    // a varint of up to 10 bytes and the buttons
+    if (gb_movie_reserve(movie, 11) != 0) {
+        return;
+    }
+    uint64_t delta = movie->elapsed - movie->last_event;
+    uint8_t *out = movie->events + movie->size;
+    while (delta >= 0x80) {
+        *out++ = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    *out++ = (uint8_t)delta;
+    *out++ = buttons;
+    movie->size = out - movie->events;
+    movie->last_event = movie->elapsed;
+    movie->buttons = buttons;
+}
+
+void gb_movie_stop(gb_movie *movie, const gb *gb) {
+    if (!movie->recording) {
+        return;
+    }
+    gb_movie_sample(movie, gb);
+    movie->length = movie->elapsed;
+    movie->recording = false;
+}
+
+int gb_movie_save(const gb_movie *movie, const char *path) {
+    gb_movie_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GB_MOVIE_MAGIC;
+    header.version = GB_MOVIE_VERSION;
+    header.start_buttons = movie->start_buttons;
+    memcpy(header.rom_check, movie->rom_check, sizeof(header.rom_check));
+    header.start_state_size = (uint32_t)movie->start_state_size;
+    header.length = movie->recording ? movie->elapsed : movie->length;
+    header.events_size = movie->size;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open movie file: %s\n", path);
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && movie->start_state_size > 0) {
+        ok = fwrite(movie->start_state, 1, movie->start_state_size, file) == movie->start_state_size;
+    }
+    if (ok && movie->size > 0) {
+        ok = fwrite(movie->events, 1, movie->size, file) == movie->size;
+    }
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Failed to write movie: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+gb_movie *gb_movie_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open movie file: %s\n", path);
+        return NULL;
+    }
+
+    gb_movie_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != GB_MOVIE_MAGIC) {
+        fprintf(stderr, "not a movie: %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if (header.version != GB_MOVIE_VERSION) {
+        fprintf(stderr, "movie version %u, expected %u\n", header.version, GB_MOVIE_VERSION);
+        fclose(file);
+        return NULL;
+    }
+
+    // the sizes come from the file, they have to fit in what's left of it before anything
+    // is allocated for them
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || st.st_size < (off_t)sizeof(header) ||
+        header.start_state_size > (uint64_t)st.st_size - sizeof(header) ||
+        header.events_size > (uint64_t)st.st_size - sizeof(header) - header.start_state_size) {
+        fprintf(stderr, "movie is damaged: %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    gb_movie *movie = calloc(1, sizeof(gb_movie));
+    if (movie == NULL) {
+        fprintf(stderr, "Failed to allocate memory for movie\n");
+        fclose(file);
+        return NULL;
+    }
+    movie->start_buttons = header.start_buttons;
+    memcpy(movie->rom_check, header.rom_check, sizeof(movie->rom_check));
+    movie->length = header.length;
+    movie->start_state_size = header.start_state_size;
+
+    bool ok = true;
+    if (movie->start_state_size > 0) {
+        movie->start_state = malloc(movie->start_state_size);
+        ok = movie->start_state != NULL &&
+             fread(movie->start_state, 1, movie->start_state_size, file) == movie->start_state_size;
+    }
+    if (ok && header.events_size > 0) {
+        ok = gb_movie_reserve(movie, header.events_size) == 0 &&
+             fread(movie->events, 1, header.events_size, file) == header.events_size;
+        movie->size = header.events_size;
+    }
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "movie is truncated: %s\n", path);
+        gb_movie_destroy(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+void gb_movie_destroy(gb_movie *movie) {
+    if (movie == NULL) {
+        return;
+    }
+    free(movie->events);
+    free(movie->start_state);
+    free(movie);
+}
+
+// read the next event, if there is one
+static void gb_movie_next(gb_movie *movie) {
+    const uint8_t *in = movie->events + movie->pos;
+    const uint8_t *end = movie->events + movie->size;
+    uint64_t delta = 0;
+    int shift = 0;
+
+    movie->have_next = false;
+    while (in < end) {
+        // longer than any 64 bit delta, the stream is damaged, end it here
+        if (shift > 63) {
+            return;
+        }
+        uint8_t byte = *in++;
+        delta |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) {
+            if (in == end) {
+                return;
+            }
+            movie->next_buttons = *in++;
+            movie->next_event = movie->last_event + delta;
+            movie->have_next = true;
+            break;
+        }
+    }
+    movie->pos = in - movie->events;
+}
+
+int gb_movie_play(gb_movie *movie, gb *gb) {
+    uint8_t rom_check[4];
+    gb_state_rom_check(gb, rom_check);
+    if (memcmp(rom_check, movie->rom_check, sizeof(rom_check)) != 0) {
+        fprintf(stderr, "movie is for a different rom\n");
+        return -1;
+    }
+    if (movie->start_state != NULL) {
+        if (movie->start_state_size != gb_state_size(gb)) {
+            fprintf(stderr, "movie start state doesn't fit this machine\n");
+            return -1;
+        }
+        if (gb_load_state(gb, movie->start_state, movie->start_state_size) != 0) {
+            return -1;
+        }
+    } else if (gb->cpu.count != 0) {
+        fprintf(stderr, "movie starts at power on, the machine has already run\n");
+        return -1;
+    }
+
+    gb_set_joypad(gb, movie->start_buttons);
+    movie->recording = false;
+    movie->buttons = movie->start_buttons;
+    movie->elapsed = 0;
+    movie->last_count = gb->cpu.count;
+    movie->last_event = 0;
+    movie->pos = 0;
+    gb_movie_next(movie);
+    return 0;
+}
+
+// apply every event that is due, before the next instruction runs
+static inline void gb_movie_catch_up(gb_movie *movie, gb *gb) {
+    gb_movie_advance(movie, gb);
+    while (movie->have_next && movie->elapsed >= movie->next_event) {
+        gb_set_joypad(gb, movie->next_buttons);
+        movie->buttons = movie->next_buttons;
+        movie->last_event = movie->next_event;
+        gb_movie_next(movie);
+    }
+}
+
+uint32_t gb_movie_run_frame(gb_movie *movie, gb *gb) {
+    uint32_t start = gb->cpu.count;
+    uint32_t frame = gb->ppu.frame_count;
+
+    while (gb->ppu.frame_count == frame) {
+        gb_movie_catch_up(movie, gb);
+        cpu_step(&gb->cpu);
+
+        // same as gb_run_frame, no vblank while the lcd is off
+        if (!gb->ppu.lcd_enabled && gb->cpu.count - start >= GB_CYCLES_PER_FRAME) {
+            break;
+        }
+    }
+    gb_movie_catch_up(movie, gb);
+    return gb->cpu.count - start;
+}
+
+bool gb_movie_finished(const gb_movie *movie) {
+    return !movie->recording && !movie->have_next && movie->elapsed >= movie->length;
+}
@@ -0,0 +1,83 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/pacer.h"
+#include "../include/gb.h"
+#include <time.h>
+
+#define PACER_MAX_LAG_NS 1000000000LL   // further behind than this we just drop the backlog
+
+void pacer_init(pacer *pacer, pacer_mode mode, double speed) {
+    pacer->max_frame_skip = 0;
+    pacer->frames_skipped = 0;
+    pacer->total_skipped = 0;
+    pacer_set_mode(pacer, mode, speed);
+}
+
+void pacer_set_mode(pacer *pacer, pacer_mode mode, double speed) {
+    pacer->mode = mode;
+    pacer->speed = (mode == PACER_REALTIME || speed <= 0) ? 1.0 : speed;
+    pacer->cycles = 0;
+    pacer->frames_skipped = 0;
+    clock_gettime(CLOCK_MONOTONIC, &pacer->base);
+}
+
+// host nanoseconds the emulated cycles so far should take
+static int64_t pacer_emulated_ns(pacer *pacer, uint64_t cycles) {
+    return (int64_t)((double)cycles * 1e9 / (PACER_CLOCK_HZ * pacer->speed));
+}
+
+// how far host time is ahead of emulated time, positive when we're behind
+static int64_t pacer_lag_ns(pacer *pacer) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsed = (int64_t)(now.tv_sec - pacer->base.tv_sec) * 1000000000LL +
+                      (now.tv_nsec - pacer->base.tv_nsec);
+    return elapsed - pacer_emulated_ns(pacer, pacer->cycles);
+}
+
+bool pacer_skip_frame(pacer *pacer) {
+    if (pacer->max_frame_skip == 0) {
+        return false;
+    }
+
+    bool skip;
+    if (pacer->mode == PACER_TURBO) {
+        // nobody sees every frame at turbo speed, only draw one in max_frame_skip + 1
+        skip = pacer->frames_skipped < pacer->max_frame_skip;
+    } else {
+        // more than a frame behind, drawing is the one thing we can leave out
+        skip = pacer->frames_skipped < pacer->max_frame_skip &&
+               pacer_lag_ns(pacer) > pacer_emulated_ns(pacer, GB_CYCLES_PER_FRAME);
+    }
+
+    if (skip) {
+        pacer->frames_skipped++;
+        pacer->total_skipped++;
+    } else {
+        pacer->frames_skipped = 0;
+    }
+    return skip;
+}
+
+void pacer_wait(pacer *pacer, uint32_t cycles) {
+    pacer->cycles += cycles;
+    if (pacer->mode == PACER_TURBO) {
+        return;
+    }
+
+    int64_t lag = pacer_lag_ns(pacer);
+
+    // way behind (debugger, suspended, host overloaded), don't try to catch up
+    if (lag > PACER_MAX_LAG_NS) {
+        clock_gettime(CLOCK_MONOTONIC, &pacer->base);
+        pacer->cycles = 0;
+        return;
+    }
+    if (lag >= 0) {
+        return;
+    }
+
+    int64_t ns = pacer->base.tv_nsec + pacer_emulated_ns(pacer, pacer->cycles);
+    struct timespec deadline = { pacer->base.tv_sec + ns / 1000000000LL, ns % 1000000000LL };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
@@ -1,7 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "../include/cpu.h"
 #include "../include/bus.h"
@@ -36,6 +44,10 @@
 #define BGP  0xFF47 // bg palette data
 #define OBP0 0xFF48 // obj palette 0 data
 #define OBP1 0xFF49 // obj palette 1 data
+#define DMA  0xFF46 // oam dma source
+
+// dot within a line at which mode 3 ends and the line is rendered
+#define RENDER_DOT (80 + 172)
 
 // lcd control bit flags
 #define LCDC_ENABLE      (1 << 7)
@@ -167,69 +179,598 @@ void ppu_init(ppu *ppu, bus *bus) {
     ppu->dot_counter = 0;
     ppu->sprite_count = 0;
     ppu->stat_irq_blocked = 0;
+    ppu->lcd_enabled = true;    // first step with the lcd off runs the switch off
+    ppu->frame_count = 0;
+    ppu->skip_frame = false;
+    ppu->skipping = false;
 
     // window line counter
     ppu->window_visible = false;
     ppu->window_line_counter = 0;
     
+    // deferred rendering, snapshot is taken on the first visible step
+    ppu->frame_logs = (ppu_frame_log *)malloc(PPU_FRAME_SLOTS * sizeof(ppu_frame_log));
+    if (ppu->frame_logs == NULL) {
+        fprintf(stderr, "Failed to allocate memory for ppu frame logs\n");
+        exit(1);
+    }
+    for (int i = 0; i < PPU_FRAME_SLOTS; i++) {
+        ppu->frame_logs[i].log_count = 0;
+        ppu->frame_logs[i].first_line = 0;
+        ppu->frame_logs[i].last_line = 0;
+        ppu->frame_logs[i].stale_pages = 0xFFFFFFFF;
+        ppu->frame_logs[i].oam_stale = true;
+        ppu->frame_logs[i].oam_changed = false;
+    }
+    ppu->sprite_lists_dirty = true;
+    ppu->sprite_lists_lcdc = 0;
+    ppu->frame_log = &ppu->frame_logs[0];
+    ppu->log_active = false;
+    ppu->render_thread_active = false;
+    bus->ppu = ppu;
     
     memset(ppu->screen_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
 
-    // printf("PPU init end - callback ptr: %p\n", (void*)ppu->frame_complete_callback);
+    // no output until a sink is set
+    memset(&ppu->sink, 0, sizeof(ppu_output_sink));
+    ppu->sink_active = false;
+    ppu->sink_pixels = NULL;
+    ppu->sink_pitch = 0;
+    memset(&ppu->observation, 0, sizeof(ppu_observation));
+}
+
+// free ppu memory
+void ppu_free(ppu *ppu) {
+    ppu_stop_render_thread(ppu);
+    if (ppu->frame_logs != NULL) {
+        free(ppu->frame_logs);
+        ppu->frame_logs = NULL;
+        ppu->frame_log = NULL;
+    }
+    if (ppu->bus != NULL && ppu->bus->ppu == ppu) {
+        ppu->bus->ppu = NULL;
+    }
+}
+
+// set output sink
+// with a render thread running, call this only after ppu_wait_render
+void ppu_set_output_sink(ppu *ppu, const ppu_output_sink *sink) {
+    if (sink == NULL) {
+        memset(&ppu->sink, 0, sizeof(ppu_output_sink));
+    } else {
+        ppu->sink = *sink;
+    }
+    if (ppu->sink.bytes_per_pixel == 0) {
+        ppu->sink.bytes_per_pixel = 4;
+    }
+    ppu->sink_active = false;
+}
+
+// get pixel memory for the frame about to be drawn
+static void ppu_sink_begin(ppu *ppu) {
+    ppu_output_sink *sink = &ppu->sink;
+
+    ppu->sink_pixels = sink->pixels;
+    ppu->sink_pitch = sink->pitch;
+    if (sink->begin_frame) {
+        ppu->sink_pixels = sink->begin_frame(sink->user, &ppu->sink_pitch);
+    }
+    if (ppu->sink_pitch == 0) {
+        ppu->sink_pitch = SCREEN_WIDTH * sink->bytes_per_pixel;
+    }
+    ppu->sink_active = true;
 }
 
-// set callback
-void ppu_set_frame_callback(ppu *ppu, void (*callback)(uint8_t *buffer)) {
-    printf("setting callback - old ptr: %p, new ptr: %p\n", 
-           (void*)ppu->frame_complete_callback, (void*)callback);
-    ppu->frame_complete_callback = callback;
-    printf("callback set - current ptr: %p\n", (void*)ppu->frame_complete_callback);
+static void ppu_sink_end(ppu *ppu) {
+    if (!ppu->sink_active) {
+        ppu_sink_begin(ppu);
+    }
+    if (ppu->sink.end_frame) {
+        ppu->sink.end_frame(ppu->sink.user, ppu->screen_buffer, ppu->sink_pixels);
+    }
+    ppu->sink_active = false;
+    ppu->sink_pixels = NULL;
 }
 
+// downscale and pack one finished line into the observation outputs
+static void ppu_observe_line(ppu *ppu, uint8_t ly) {
+    const ppu_observation *observation = &ppu->observation;
+    ppu_observation_tables *tables = &ppu->observation_tables;
+    const uint8_t *scanline = &ppu->screen_buffer[ly * SCREEN_WIDTH];
+
+    if (observation->packed != NULL) {
+        uint8_t *out = &observation->packed[ly * (SCREEN_WIDTH / 4)];
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            out[x / 4] = (scanline[x] << 6) | (scanline[x + 1] << 4) | (scanline[x + 2] << 2) | scanline[x + 3];
+        }
+    }
+
+    if (observation->pixels == NULL) {
+        return;
+    }
+    uint8_t y = tables->row_out[ly];
+    uint8_t *out = &observation->pixels[y * observation->width];
+
+    if (!observation->box_filter) {
+        if (tables->row_emit[ly]) {
+            for (int x = 0; x < observation->width; x++) {
+                out[x] = observation->gray[scanline[tables->col_pick[x]]];
+            }
+        }
+        return;
+    }
+
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        tables->sum[tables->col_out[x]] += observation->gray[scanline[x]];
+    }
+    if (tables->row_emit[ly]) {
+        for (int x = 0; x < observation->width; x++) {
+            uint32_t count = tables->row_count[y] * tables->col_count[x];
+            out[x] = (uint8_t)((tables->sum[x] + count / 2) / count);
+            tables->sum[x] = 0;
+        }
+    }
+}
+
+// redo the observation outputs from the last frame on screen, for when the lcd was off
+void ppu_observe_screen(ppu *ppu) {
+    memset(ppu->observation_tables.sum, 0, sizeof(ppu->observation_tables.sum));
+    for (int ly = 0; ly < SCREEN_HEIGHT; ly++) {
+        ppu_observe_line(ppu, ly);
+    }
+}
+
+// set observation outputs, NULL turns them off
+// with a render thread running, call this only after ppu_wait_render
+int ppu_set_observation(ppu *ppu, const ppu_observation *observation) {
+    ppu_observation_tables *tables = &ppu->observation_tables;
+
+    if (observation == NULL) {
+        memset(&ppu->observation, 0, sizeof(ppu_observation));
+        return 0;
+    }
+    if (observation->pixels != NULL && (observation->width == 0 || observation->width > SCREEN_WIDTH ||
+                                        observation->height == 0 || observation->height > SCREEN_HEIGHT)) {
+        fprintf(stderr, "observation size %dx%d out of range\n", observation->width, observation->height);
+        return -1;
+    }
+
+    ppu->observation = *observation;
+    if (!observation->gray[0] && !observation->gray[1] && !observation->gray[2] && !observation->gray[3]) {
+        ppu->observation.gray[0] = 255;
+        ppu->observation.gray[1] = 170;
+        ppu->observation.gray[2] = 85;
+        ppu->observation.gray[3] = 0;
+    }
+    if (observation->pixels == NULL) {
+        return 0;
+    }
+
+    // each source line and column belongs to exactly one output row and column
+    uint8_t height = observation->height;
+    for (int y = 0; y < height; y++) {
+        int first = y * SCREEN_HEIGHT / height;
+        int end = (y + 1) * SCREEN_HEIGHT / height;
+        int emit = observation->box_filter ? end - 1 : first + (end - first) / 2;
+        tables->row_count[y] = end - first;
+        for (int ly = first; ly < end; ly++) {
+            tables->row_out[ly] = y;
+            tables->row_emit[ly] = ly == emit;
+        }
+    }
+
+    uint8_t width = observation->width;
+    for (int x = 0; x < width; x++) {
+        int first = x * SCREEN_WIDTH / width;
+        int end = (x + 1) * SCREEN_WIDTH / width;
+        tables->col_count[x] = end - first;
+        tables->col_pick[x] = first + (end - first) / 2;
+        for (int px = first; px < end; px++) {
+            tables->col_out[px] = x;
+        }
+    }
+    memset(tables->sum, 0, sizeof(tables->sum));
+    return 0;
+}
+
+// convert a drawn line to final pixels through the sink palette, and to the observation
+// outputs
+static inline void ppu_output_line(ppu *ppu, uint8_t ly) {
+    if (ppu->observation.pixels != NULL || ppu->observation.packed != NULL) {
+        ppu_observe_line(ppu, ly);
+    }
+    if (ppu->sink_pixels == NULL) {
+        return;
+    }
+    const uint8_t *scanline = &ppu->screen_buffer[ly * SCREEN_WIDTH];
+    const uint32_t *palette = ppu->sink.palette;
+    uint8_t *row = (uint8_t *)ppu->sink_pixels + (ly * ppu->sink_pitch);
+
+    switch (ppu->sink.bytes_per_pixel) {
+        case 4: {
+            uint32_t *out = (uint32_t *)row;
+            for (int x = 0; x < SCREEN_WIDTH; x++) out[x] = palette[scanline[x]];
+            break;
+        }
+        case 2: {
+            uint16_t *out = (uint16_t *)row;
+            for (int x = 0; x < SCREEN_WIDTH; x++) out[x] = (uint16_t)palette[scanline[x]];
+            break;
+        }
+        default:
+            for (int x = 0; x < SCREEN_WIDTH; x++) row[x] = (uint8_t)palette[scanline[x]];
+            break;
+    }
+}
+
+// the stat interrupt line is the OR of every enabled stat condition. the interrupt is only
+// requested when the line goes from low to high, so a condition that stays true (a whole
+// hblank, or LY=LYC for a full line) requests it once. the line is recomputed when the mode,
+// LY, LYC or the stat enable bits change instead of on every step
 void ppu_check_stat_interrupts(ppu *ppu) {
-    uint8_t stat = bus_read8(ppu->bus, STAT);
-    uint8_t if_reg = bus_read8(ppu->bus, 0xFF0F);
-    bool interrupt_requested = false;
-    
-    // LY=LYC check
-    uint8_t lyc = bus_read8(ppu->bus, LYC);
-    // printf("checking stats - LY:%d LYC:%d STAT before:%02X\n", 
-    //        ppu->current_ly, lyc, stat);
+    uint8_t *memory = ppu->bus->memory;
+    uint8_t stat = memory[STAT] & ~(STAT_LYC_EQUAL | STAT_MODE_MASK);
+    bool line = false;
 
-    if (ppu->current_ly == lyc) {
+    // line is held low while the lcd is off
+    if (!(memory[LCDC] & LCDC_ENABLE)) {
+        memory[STAT] = stat | MODE_HBLANK;
+        ppu->stat_irq_blocked = 0;
+        return;
+    }
+
+    // LY=LYC check
+    if (ppu->current_ly == memory[LYC]) {
         stat |= STAT_LYC_EQUAL;
-        // printf("LY=LYC match. STAT after setting equal bit:%02X\n", stat);
-        if (stat & STAT_LYC_INT) {
-            // printf("LYC interrupt enabled in STAT\n");
-            interrupt_requested = true;
-        }
-    } else {
-        stat &= ~STAT_LYC_EQUAL;
+        if (stat & STAT_LYC_INT) line = true;
     }
 
     // mode interrupts
     switch(ppu->mode) {
         case MODE_HBLANK:
-            if (stat & STAT_HBLANK_INT) interrupt_requested = true;
+            if (stat & STAT_HBLANK_INT) line = true;
             break;
         case MODE_VBLANK:
-            if (stat & STAT_VBLANK_INT) interrupt_requested = true;
+            if (stat & STAT_VBLANK_INT) line = true;
             break;
         case MODE_OAM_SCAN:
-            if (stat & STAT_OAM_INT) interrupt_requested = true;
+            if (stat & STAT_OAM_INT) line = true;
             break;
     }
 
-    // write back STAT updates
-    bus_write8(ppu->bus, STAT, stat);
-    // printf("wrote STAT:%02X back to memory\n", stat);
+    memory[STAT] = stat | ppu->mode;
+
+    // request on the rising edge only
+    if (line && !ppu->stat_irq_blocked) {
+        memory[0xFF0F] |= 0x02;
+    }
+    ppu->stat_irq_blocked = line;
+}
+
+// move to a new mode and/or line, keeping LY, STAT and the stat line in sync
+static inline void ppu_set_mode(ppu *ppu, uint8_t mode, uint8_t ly) {
+    ppu->mode = mode;
+    ppu->current_ly = ly;
+    ppu->bus->memory[LY] = ly;
+    ppu_check_stat_interrupts(ppu);
+}
+
+// deferred rendering:
+// instead of drawing each line when mode 3 ends, the ppu takes a snapshot of vram, oam and
+// the video registers at the start of the frame, and logs every write to them during the
+// visible period stamped with the line and dot it happened on. at vblank (or on demand
+// through ppu_flush) the log is replayed against the snapshot one line at a time, so each
+// line still sees the register values it would have seen at the end of its mode 3
+
+// dot within the current line, from the mode and the dots spent in it
+static inline uint16_t ppu_line_dot(ppu *ppu) {
+    switch (ppu->mode) {
+        case MODE_OAM_SCAN: return ppu->dot_counter;
+        case MODE_DRAWING:  return 80 + ppu->dot_counter;
+        case MODE_HBLANK:   return RENDER_DOT + ppu->dot_counter;
+        default:            return ppu->dot_counter;
+    }
+}
+
+// lock-free single producer / single consumer queue of frame log slots
+static inline void ppu_queue_push(ppu_queue *queue, uint8_t slot) {
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    queue->slots[head % PPU_QUEUE_SIZE] = slot;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static inline int ppu_queue_pop(ppu_queue *queue) {
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    uint8_t slot = queue->slots[tail % PPU_QUEUE_SIZE];
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return slot;
+}
+
+// copy the live video state into the current slot and start logging
+// vram is copy-on-write per 256 byte page: only pages the bus has written since
+// this slot was last filled are copied
+static void ppu_snapshot(ppu *ppu, uint8_t first_line) {
+    ppu_frame_log *frame_log = ppu->frame_log;
+    uint8_t *memory = ppu->bus->memory;
+
+    uint32_t dirty = ppu->bus->vram_dirty;
+    ppu->bus->vram_dirty = 0;
+    for (int i = 0; i < PPU_FRAME_SLOTS; i++) {
+        ppu->frame_logs[i].stale_pages |= dirty;
+    }
+
+    bool oam_dirty = ppu->bus->oam_dirty;
+    ppu->bus->oam_dirty = false;
+    for (int i = 0; i < PPU_FRAME_SLOTS; i++) {
+        ppu->frame_logs[i].oam_stale |= oam_dirty;
+    }
 
-    // request STAT interrupt if needed
-    if (interrupt_requested) {
-        // printf("stat interrupt requested. Current LY:%d\n", ppu->current_ly);
-        // printf("IF before:%02X after:%02X\n", 
-        //        if_reg, if_reg | 0x02);
-        bus_write8(ppu->bus, 0xFF0F, if_reg | 0x02);
+    uint32_t stale = frame_log->stale_pages;
+    while (stale) {
+        int page = __builtin_ctz(stale);
+        memcpy(&frame_log->vram[page << 8], &ppu->vram[page << 8], 0x100);
+        stale &= stale - 1;
+    }
+    frame_log->stale_pages = 0;
+
+    if (frame_log->oam_stale) {
+        memcpy(frame_log->oam, ppu->oam, PPU_OAM_SIZE);
+        frame_log->oam_stale = false;
+        frame_log->oam_changed = true;
+    }
+    frame_log->regs.lcdc = memory[LCDC];
+    frame_log->regs.scy = memory[SCY];
+    frame_log->regs.scx = memory[SCX];
+    frame_log->regs.wy = memory[WY];
+    frame_log->regs.wx = memory[WX];
+    frame_log->regs.bgp = memory[BGP];
+    frame_log->regs.obp0 = memory[OBP0];
+    frame_log->regs.obp1 = memory[OBP1];
+
+    frame_log->log_count = 0;
+    frame_log->first_line = first_line;
+    frame_log->last_line = first_line;
+    frame_log->end_of_frame = false;
+
+    ppu->log_active = true;
+}
+
+// take a free slot back from the render thread, waiting if it is a frame behind
+static void ppu_acquire_slot(ppu *ppu) {
+    if (ppu->frame_log != NULL) {
+        return;
+    }
+    sem_wait(&ppu->render_free);
+    // the render thread pushes the slot before posting, and the post/wait pair orders the
+    // push before this pop, so a slot is always there
+    int slot = ppu_queue_pop(&ppu->free_queue);
+    assert(slot >= 0);
+    ppu->frame_log = &ppu->frame_logs[slot];
+}
+
+static void ppu_begin_frame(ppu *ppu) {
+    ppu_acquire_slot(ppu);
+    ppu_snapshot(ppu, ppu->current_ly);
+}
+
+// apply one logged write to the snapshot
+// runs on the render side, so it also marks the sprite lists for a rebuild
+static inline void ppu_apply_log_entry(ppu *ppu, ppu_frame_log *frame_log, const ppu_log_entry *entry) {
+    uint16_t address = entry->address;
+
+    if (address >= VRAM_START && address < VRAM_START + PPU_VRAM_SIZE) {
+        frame_log->vram[address - VRAM_START] = entry->value;
+    } else if (address >= OAM_START && address <= OAM_END) {
+        frame_log->oam[address - OAM_START] = entry->value;
+        ppu->sprite_lists_dirty = true;
+    } else {
+        switch (address) {
+            case LCDC: frame_log->regs.lcdc = entry->value; break;
+            case SCY:  frame_log->regs.scy = entry->value; break;
+            case SCX:  frame_log->regs.scx = entry->value; break;
+            case WY:   frame_log->regs.wy = entry->value; break;
+            case WX:   frame_log->regs.wx = entry->value; break;
+            case BGP:  frame_log->regs.bgp = entry->value; break;
+            case OBP0: frame_log->regs.obp0 = entry->value; break;
+            case OBP1: frame_log->regs.obp1 = entry->value; break;
+        }
+    }
+}
+
+// render every line of a slot that has finished mode 3, then apply the rest of its log
+// afterwards the snapshot matches live memory as of the hand off
+// runs on the render thread when one is active
+static void ppu_render_frame_log(ppu *ppu, ppu_frame_log *frame_log) {
+    uint16_t pos = 0;
+
+    // snapshot took a new copy of oam
+    if (frame_log->oam_changed) {
+        ppu->sprite_lists_dirty = true;
+        frame_log->oam_changed = false;
+    }
+
+    // start of a new frame
+    if (frame_log->first_line == 0) {
+        ppu->window_line_counter = 0;
+        memset(ppu->screen_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
+        memset(ppu->observation_tables.sum, 0, sizeof(ppu->observation_tables.sum));
+    }
+
+    if (!ppu->sink_active && frame_log->first_line < frame_log->last_line) {
+        ppu_sink_begin(ppu);
+    }
+
+    for (int line = frame_log->first_line; line < frame_log->last_line; line++) {
+        // writes made before this line's mode 3 ended are visible to it
+        while (pos < frame_log->log_count &&
+               (frame_log->log[pos].ly < line ||
+               (frame_log->log[pos].ly == line && frame_log->log[pos].dot < RENDER_DOT))) {
+            ppu_apply_log_entry(ppu, frame_log, &frame_log->log[pos++]);
+        }
+        ppu_render_scanline(ppu, frame_log, line);
+    }
+
+    while (pos < frame_log->log_count) {
+        ppu_apply_log_entry(ppu, frame_log, &frame_log->log[pos++]);
+    }
+
+    frame_log->log_count = 0;
+    frame_log->first_line = frame_log->last_line;
+
+    if (frame_log->end_of_frame) {
+        ppu_sink_end(ppu);
+    }
+}
+
+// hand the current slot to the renderer and stop logging
+// without a render thread the slot is drawn right away and stays current
+static void ppu_submit(ppu *ppu, bool end_of_frame) {
+    ppu_frame_log *frame_log = ppu->frame_log;
+    frame_log->end_of_frame = end_of_frame;
+    ppu->log_active = false;
+
+    if (!ppu->render_thread_active) {
+        ppu_render_frame_log(ppu, frame_log);
+        return;
+    }
+
+    ppu_queue_push(&ppu->render_queue, (uint8_t)(frame_log - ppu->frame_logs));
+    sem_post(&ppu->render_ready);
+    ppu->frame_log = NULL;
+}
+
+// called by the bus for every video write while logging is active
+void ppu_log_write(ppu *ppu, uint16_t address, uint8_t value) {
+    // dma source may change before vblank, so catch up and take the new oam directly
+    if (address == DMA) {
+        ppu_flush(ppu);
+        memcpy(ppu->frame_log->oam, ppu->oam, PPU_OAM_SIZE);
+        ppu->frame_log->oam_changed = true;
+        return;
+    }
+
+    if (ppu->frame_log->log_count == PPU_LOG_SIZE) {
+        ppu_flush(ppu);
+    }
+
+    ppu_frame_log *frame_log = ppu->frame_log;
+    ppu_log_entry *entry = &frame_log->log[frame_log->log_count++];
+    entry->address = address;
+    entry->value = value;
+    entry->ly = ppu->current_ly;
+    entry->dot = ppu_line_dot(ppu);
+}
+
+// render (or queue for rendering) every line that has finished mode 3
+// logging continues from the current state afterwards
+void ppu_flush(ppu *ppu) {
+    if (!ppu->log_active) {
+        return;
+    }
+    uint8_t last_line = ppu->frame_log->last_line;
+    ppu_submit(ppu, false);
+    if (ppu->frame_log == NULL) {
+        ppu_acquire_slot(ppu);
+        ppu_snapshot(ppu, last_line);
+    }
+    ppu->log_active = true;
+}
+
+// live memory was replaced under the renderer (save state load), drop the frame being logged
+// every page is marked stale so the next step snapshots it all again from the current line
+// slots already handed to a render thread are still drawn
+void ppu_restart_frame(ppu *ppu) {
+    if (ppu->log_active) {
+        ppu->frame_log->log_count = 0;
+        ppu->log_active = false;
+    }
+    ppu->skipping = false;
+    ppu->bus->vram_dirty = 0xFFFFFFFF;
+    ppu->bus->oam_dirty = true;
+}
+
+// render thread
+// renders slots in the order they were handed off and returns them to the free queue
+static void *ppu_render_thread(void *arg) {
+    ppu *ppu = arg;
+    for (;;) {
+        sem_wait(&ppu->render_ready);
+        int slot = ppu_queue_pop(&ppu->render_queue);
+        if (slot < 0) {
+            // woken with nothing queued, only done when stopping
+            break;
+        }
+        ppu_render_frame_log(ppu, &ppu->frame_logs[slot]);
+        ppu_queue_push(&ppu->free_queue, (uint8_t)slot);
+        sem_post(&ppu->render_free);
+    }
+    return NULL;
+}
+
+// render frames on a worker thread while the cpu emulates the next one
+// the output sink is then called from that thread
+int ppu_start_render_thread(ppu *ppu) {
+    if (ppu->render_thread_active) {
+        return 0;
+    }
+
+    // the cpu keeps its current slot, every other slot starts free
+    if (ppu->frame_log == NULL) {
+        ppu->frame_log = &ppu->frame_logs[0];
+    }
+    memset(&ppu->render_queue, 0, sizeof(ppu_queue));
+    memset(&ppu->free_queue, 0, sizeof(ppu_queue));
+    sem_init(&ppu->render_ready, 0, 0);
+    sem_init(&ppu->render_free, 0, 0);
+    for (int i = 0; i < PPU_FRAME_SLOTS; i++) {
+        if (&ppu->frame_logs[i] != ppu->frame_log) {
+            ppu_queue_push(&ppu->free_queue, (uint8_t)i);
+            sem_post(&ppu->render_free);
+        }
+    }
+
+    if (pthread_create(&ppu->render_thread, NULL, ppu_render_thread, ppu) != 0) {
+        fprintf(stderr, "failed to start ppu render thread\n");
+        sem_destroy(&ppu->render_ready);
+        sem_destroy(&ppu->render_free);
+        return -1;
+    }
+    ppu->render_thread_active = true;
+    return 0;
+}
+
+// wait until the render thread has drawn everything handed to it
+void ppu_wait_render(ppu *ppu) {
+    if (!ppu->render_thread_active) {
+        return;
+    }
+    // every slot the cpu isn't holding comes back to the free queue once drawn
+    int held = (ppu->frame_log != NULL) ? 1 : 0;
+    for (int i = 0; i < PPU_FRAME_SLOTS - held; i++) {
+        sem_wait(&ppu->render_free);
+    }
+    for (int i = 0; i < PPU_FRAME_SLOTS - held; i++) {
+        sem_post(&ppu->render_free);
+    }
+}
+
+void ppu_stop_render_thread(ppu *ppu) {
+    if (!ppu->render_thread_active) {
+        return;
+    }
+    ppu_wait_render(ppu);
+    sem_post(&ppu->render_ready);
+    pthread_join(ppu->render_thread, NULL);
+    sem_destroy(&ppu->render_ready);
+    sem_destroy(&ppu->render_free);
+    ppu->render_thread_active = false;
+
+    // back to drawing inline with a single slot
+    if (ppu->frame_log == NULL) {
+        ppu->frame_log = &ppu->frame_logs[0];
     }
 }
 
@@ -245,41 +786,100 @@ void ppu_check_stat_interrupts(ppu *ppu) {
 // - LY + 16 must be < sprite y position + the sprite height 
 // - the amount of sprites stored in the OAM buffer must be less than 10
 
-void ppu_oam_scan(ppu *ppu) {
-    uint8_t lcdc = bus_read8(ppu->bus, LCDC);
+// instead of walking oam for every line, the renderer keeps a list of sprites for each
+// line of the frame, already in drawing priority order. the lists are rebuilt only when
+// oam or the sprite size changes, which for most games is once per frame at most
+
+// bit i is set when sprite i covers the row (LY + 16). ys holds the 40 y positions padded
+// to 48 with zeros, which never match since row - 0 >= 16 >= sprite height
+#ifdef __SSE2__
+static inline uint64_t ppu_sprites_on_row(const uint8_t *ys, uint8_t row, uint8_t sprite_height) {
+    // unsigned (row - y) < height, tested 16 sprites at a time
+    __m128i rows = _mm_set1_epi8((char)row);
+    __m128i max_row = _mm_set1_epi8((char)(sprite_height - 1));
+    uint64_t mask = 0;
+    for (int i = 0; i < 48; i += 16) {
+        __m128i sprite_row = _mm_sub_epi8(rows, _mm_loadu_si128((const __m128i *)&ys[i]));
+        __m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(sprite_row, max_row), sprite_row);
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(hit) << i;
+    }
+    return mask;
+}
+#else
+static inline uint64_t ppu_sprites_on_row(const uint8_t *ys, uint8_t row, uint8_t sprite_height) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 40; i++) {
+        if ((uint8_t)(row - ys[i]) < sprite_height) {
+            mask |= (uint64_t)1 << i;
+        }
+    }
+    return mask;
+}
+#endif
+
+// rebuild every line's sprite list from oam
+static void ppu_build_sprite_lists(ppu *ppu, const uint8_t *oam, uint8_t lcdc) {
     uint8_t sprite_height = (lcdc & LCDC_OBJ_SIZE) ? 16 : 8;
+    uint8_t ys[48] = {0};
+    uint64_t visible = 0;
+
+    // sprites with x = 0 are never added
+    for (int i = 0; i < 40; i++) {
+        ys[i] = oam[i * 4];
+        if (oam[i * 4 + 1] != 0) {
+            visible |= (uint64_t)1 << i;
+        }
+    }
+
+    for (int ly = 0; ly < SCREEN_HEIGHT; ly++) {
+        uint64_t hits = ppu_sprites_on_row(ys, ly + 16, sprite_height) & visible;
+        uint8_t *list = ppu->line_sprites[ly];
+        uint8_t count = 0;
+
+        // first 10 in oam order, insertion sorted by x then index
+        while (hits && count < MAX_SPRITES_PER_LINE) {
+            uint8_t index = __builtin_ctzll(hits);
+            uint8_t x_pos = oam[index * 4 + 1];
+            int j = count - 1;
+            // index only grows here, so ties on x keep oam order
+            while (j >= 0 && oam[list[j] * 4 + 1] > x_pos) {
+                list[j + 1] = list[j];
+                j--;
+            }
+            list[j + 1] = index;
+            count++;
+            hits &= hits - 1;
+        }
+        ppu->line_sprite_count[ly] = count;
+    }
+
+    ppu->sprite_lists_dirty = false;
+    ppu->sprite_lists_lcdc = lcdc;
+}
+
+// OAM scan (mode 2), done at render time from the per-line lists
+// fills sprite_buffer with the line's sprites, sorted by x position then oam index
+void ppu_oam_scan(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly) {
+    uint8_t *oam = frame_log->oam;
+    uint8_t lcdc = frame_log->regs.lcdc;
     
     // reset sprite count for new scanline
     ppu->sprite_count = 0;
     
     // perform oam scan if sprites are enabled
     if (lcdc & LCDC_OBJ_ON) {
-        // scan all 40 sprites in oam
-        for (int i = 0; i < 40 && ppu->sprite_count < MAX_SPRITES_PER_LINE; i++) {
-            // each sprite uses 4 bytes in oam
-            uint16_t sprite_addr = OAM_START + (i * 4);
-            
-            // read sprite attributes
-            uint8_t y_pos = ppu->oam[i * 4];
-            uint8_t x_pos = ppu->oam[i * 4 + 1];
-            uint8_t tile_num = ppu->oam[i * 4 + 2];
-            uint8_t flags = ppu->oam[i * 4 + 3];
-            
-            // check if sprite is on current scanline
-            int16_t sprite_row = (ppu->current_ly + 16) - y_pos;
-            
-            if (sprite_row >= 0 && sprite_row < sprite_height && x_pos != 0) {
-                
-                // add sprite to buffer
-                sprite_data *sprite = &ppu->sprite_buffer[ppu->sprite_count];
-                sprite->y_pos = y_pos;
-                sprite->x_pos = x_pos;
-                sprite->tile_num = tile_num;
-                sprite->flags = flags;
-                sprite->index = i;
-                
-                ppu->sprite_count++; 
-            }
+        if (ppu->sprite_lists_dirty || ((lcdc ^ ppu->sprite_lists_lcdc) & LCDC_OBJ_SIZE)) {
+            ppu_build_sprite_lists(ppu, oam, lcdc);
+        }
+
+        for (int i = 0; i < ppu->line_sprite_count[ly]; i++) {
+            uint8_t index = ppu->line_sprites[ly][i];
+            sprite_data *sprite = &ppu->sprite_buffer[ppu->sprite_count++];
+            sprite->y_pos = oam[index * 4];
+            sprite->x_pos = oam[index * 4 + 1];
+            sprite->tile_num = oam[index * 4 + 2];
+            sprite->flags = oam[index * 4 + 3];
+            sprite->index = index;
         }
     }
 }
@@ -289,74 +889,89 @@ void ppu_oam_scan(ppu *ppu) {
 // - duration depends on multiple variables
 // - actually writes to screen buffer 
 
-void ppu_render_scanline(ppu *ppu) {
-    uint8_t lcdc = bus_read8(ppu->bus, LCDC);
-    uint8_t *scanline = &ppu->screen_buffer[ppu->current_ly * SCREEN_WIDTH];
+// the scanline renderer is specialized for the lcdc bits it branches on (bg on, sprites
+// on, sprite size, tile addressing, window on). ppu_render_line is always inlined with
+// those bits as a constant, so every variant below has no lcdc tests in its pixel loops.
+// the tile map select bits and lcd enable are still read at runtime since they only pick
+// base addresses
+
+#define PPU_RENDER_BITS (LCDC_WINDOW_ON | LCDC_TILE_SEL | LCDC_OBJ_SIZE | LCDC_OBJ_ON | LCDC_BG_ON)
+
+// lcdc bits 0-2, 4 and 5 packed into a 5 bit variant index and back
+#define PPU_RENDER_INDEX(lcdc) (((lcdc) & 0x07) | (((lcdc) >> 1) & 0x18))
+#define PPU_RENDER_LCDC(index) (((index) & 0x07) | (((index) & 0x18) << 1))
+
+// the two bytes for one row of a bg/window tile
+static inline __attribute__((always_inline))
+const uint8_t *ppu_tile_row(const uint8_t *vram, uint8_t tile_num, uint8_t fine_y, const uint8_t lcdc) {
+    if (lcdc & LCDC_TILE_SEL) {
+        // 8000 method, unsigned tile number
+        return &vram[(tile_num * 16) + (fine_y * 2)];
+    }
+    // 8800 method, signed tile number from 0x9000
+    return &vram[0x1000 + ((int8_t)tile_num * 16) + (fine_y * 2)];
+}
+
+static inline __attribute__((always_inline))
+void ppu_render_line(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly, const uint8_t lcdc) {
+    // render from the snapshot, which the log has been replayed up to this line
+    ppu_registers *regs = &frame_log->regs;
+    uint8_t *vram = frame_log->vram;
+    uint8_t *scanline = &ppu->screen_buffer[ly * SCREEN_WIDTH];
+
+    // background palette
+    uint8_t bg_palette[4];
+    for (int color = 0; color < 4; color++) {
+        bg_palette[color] = (regs->bgp >> (color * 2)) & 3;
+    }
+
+    // find the sprites on this line
+    if (lcdc & LCDC_OBJ_ON) {
+        ppu_oam_scan(ppu, frame_log, ly);
+    }
     
     // if background is enabled
-    // if (lcdc & !LCDC_BG_ON) {
-    //     printf("LCDC BG OFF");
-    // }
     if (lcdc & LCDC_BG_ON) {
-        uint8_t scy = bus_read8(ppu->bus, SCY);
-        uint8_t scx = bus_read8(ppu->bus, SCX);
-        uint16_t bg_map = (lcdc & LCDC_BG_MAP) ? 0x9C00 : 0x9800;
+        uint8_t scx = regs->scx;
+        const uint8_t *bg_map = &vram[((regs->lcdc & LCDC_BG_MAP) ? 0x9C00 : 0x9800) - VRAM_START];
         
         // calculate y position in background map
-        uint8_t y = (ppu->current_ly + scy) & 0xFF;
+        uint8_t y = (ly + regs->scy) & 0xFF;
         uint8_t tile_y = y >> 3;  // divide by 8
         uint8_t fine_y = y & 7;   // y % 8
         
-        // render each pixel in the scanline
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
+        // render a tile row at a time, the first tile may be cut off by scx
+        int x = 0;
+        while (x < SCREEN_WIDTH) {
             uint8_t mapped_x = (x + scx) & 0xFF;
-            uint8_t tile_x = mapped_x >> 3;
-            uint8_t fine_x = mapped_x & 7;
-            
-            // get tile number from background map
-            uint16_t tile_addr = bg_map + (tile_y * 32) + tile_x;
-            uint8_t tile_num = ppu->vram[tile_addr - VRAM_START];
-            
-            // get tile data address
-            uint16_t tile_data;
-            if (lcdc & LCDC_TILE_SEL) {
-                tile_data = 0x8000 + (tile_num * 16);
-            } else {
-                tile_data = 0x9000 + ((int8_t)tile_num * 16);
-            }
+            uint8_t tile_num = bg_map[(tile_y * 32) + (mapped_x >> 3)];
+            const uint8_t *row = ppu_tile_row(vram, tile_num, fine_y, lcdc);
+            uint8_t byte1 = row[0];
+            uint8_t byte2 = row[1];
 
-            // get the two bytes for this line of the tile
-            uint8_t byte1 = ppu->vram[(tile_data + (fine_y * 2)) - VRAM_START];
-            uint8_t byte2 = ppu->vram[(tile_data + (fine_y * 2) + 1) - VRAM_START];
-            
-            // combine bits for color
-            uint8_t bit = 7 - fine_x;
-            uint8_t color = ((byte1 >> bit) & 1) | (((byte2 >> bit) & 1) << 1);
-            
-            // apply background palette
-            uint8_t bgp = bus_read8(ppu->bus, BGP);
-            color = (bgp >> (color * 2)) & 3;
-            
-            scanline[x] = color;
+            for (int fine_x = mapped_x & 7; fine_x < 8 && x < SCREEN_WIDTH; fine_x++, x++) {
+                // combine bits for color
+                uint8_t bit = 7 - fine_x;
+                uint8_t color = ((byte1 >> bit) & 1) | (((byte2 >> bit) & 1) << 1);
+                scanline[x] = bg_palette[color];
+            }
         }
     } else {
         // print white (or color 0)
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            scanline[x] = 0;
-        }
+        memset(scanline, 0, SCREEN_WIDTH);
     }
 
     // The window becomes visible (if enabled) when positions are set in range WX=0..166, WY=0..143. 
     // A postion of WX=7, WY=0 locates the window at upper left, it is then completly covering normal background.
-    if ((lcdc & LCDC_WINDOW_ON) && (lcdc & LCDC_ENABLE)) {
-        uint8_t wy = bus_read8(ppu->bus, WY);
-        uint8_t wx = bus_read8(ppu->bus, WX);
+    if ((lcdc & LCDC_WINDOW_ON) && (regs->lcdc & LCDC_ENABLE)) {
+        uint8_t wy = regs->wy;
+        uint8_t wx = regs->wx;
         
         // check if window coordinates are in valid range
-        
-        if (wx <= 166 && wy <= 143 && ppu->current_ly >= wy) {
+        if (wx <= 166 && wy <= 143 && ly >= wy) {
             // calculate effective window x position
             uint8_t window_x = wx - 7;
+            int window_width = SCREEN_WIDTH - window_x;
             
             // calculate window y using line counter
             uint8_t window_y = ppu->window_line_counter;
@@ -364,36 +979,20 @@ void ppu_render_scanline(ppu *ppu) {
             uint8_t fine_y = window_y & 7;
             
             // get window tile map
-            uint16_t window_map = (lcdc & LCDC_WINDOW_MAP) ? 0x9C00 : 0x9800;
+            const uint8_t *window_map = &vram[((regs->lcdc & LCDC_WINDOW_MAP) ? 0x9C00 : 0x9800) - VRAM_START];
+            uint8_t *window_line = &scanline[window_x];
             
-            // render window pixels
-            for (int x = 0; x < SCREEN_WIDTH - window_x; x++) {
-                int screen_x = window_x + x;
-                
-                if (screen_x >= 0 && screen_x < SCREEN_WIDTH) {
-                    uint8_t tile_x = x >> 3;
-                    uint8_t fine_x = x & 7;
-                    
-                    uint16_t tile_addr = window_map + (tile_y * 32) + tile_x;
-                    uint8_t tile_num = ppu->vram[tile_addr - VRAM_START];
-                    
-                    uint16_t tile_data;
-                    if (lcdc & LCDC_TILE_SEL) {
-                        tile_data = 0x8000 + (tile_num * 16);
-                    } else {
-                        tile_data = 0x9000 + ((int8_t)tile_num * 16);
-                    }
-                    
-                    uint8_t byte1 = ppu->vram[(tile_data + (fine_y * 2)) - VRAM_START];
-                    uint8_t byte2 = ppu->vram[(tile_data + (fine_y * 2) + 1) - VRAM_START];
-                    
+            // render window pixels, a tile row at a time
+            for (int x = 0; x < window_width; x += 8) {
+                uint8_t tile_num = window_map[(tile_y * 32) + (x >> 3)];
+                const uint8_t *row = ppu_tile_row(vram, tile_num, fine_y, lcdc);
+                uint8_t byte1 = row[0];
+                uint8_t byte2 = row[1];
+
+                for (int fine_x = 0; fine_x < 8 && x + fine_x < window_width; fine_x++) {
                     uint8_t bit = 7 - fine_x;
                     uint8_t color = ((byte1 >> bit) & 1) | (((byte2 >> bit) & 1) << 1);
-                    
-                    uint8_t bgp = bus_read8(ppu->bus, BGP);
-                    color = (bgp >> (color * 2)) & 3;
-                    
-                    ppu->screen_buffer[ppu->current_ly * SCREEN_WIDTH + screen_x] = color;
+                    window_line[x + fine_x] = bg_palette[color];
                 }
             }
             
@@ -404,34 +1003,27 @@ void ppu_render_scanline(ppu *ppu) {
     
     // render sprites if enabled
     if (lcdc & LCDC_OBJ_ON) {
+        const uint8_t sprite_height = (lcdc & LCDC_OBJ_SIZE) ? 16 : 8;
 
-        // sort sprites by x position and index
-        for (int i = 1; i < ppu->sprite_count; i++) {
-            sprite_data key = ppu->sprite_buffer[i];
-            int j = i - 1;
-            
-            while (j >= 0 && 
-                (ppu->sprite_buffer[j].x_pos > key.x_pos || 
-                (ppu->sprite_buffer[j].x_pos == key.x_pos && 
-                    ppu->sprite_buffer[j].index > key.index))) {
-                ppu->sprite_buffer[j + 1] = ppu->sprite_buffer[j];
-                j--;
-            }
-            ppu->sprite_buffer[j + 1] = key;
+        // sprite_buffer is already in priority order, only resolve the two palettes once
+        uint8_t obj_palettes[2][4];
+        for (int color = 0; color < 4; color++) {
+            obj_palettes[0][color] = (regs->obp0 >> (color * 2)) & 3;
+            obj_palettes[1][color] = (regs->obp1 >> (color * 2)) & 3;
         }
 
-
         // render sprites from highest to lowest priority (reverse order)
         // lower priority sprites are drawn first and can be overwritten
         for (int i = ppu->sprite_count - 1; i >= 0; i--) {
             sprite_data *sprite = &ppu->sprite_buffer[i];
+            uint8_t *palette = obj_palettes[(sprite->flags & 0x10) ? 1 : 0];
             
             // calculate vertical line being drawn on sprite
-            int16_t line = ppu->current_ly - (sprite->y_pos - 16);
+            int16_t line = ly - (sprite->y_pos - 16);
             
             // if sprite is vertically flipped
             if (sprite->flags & 0x40) {
-                line = ((lcdc & LCDC_OBJ_SIZE) ? 15 : 7) - line;
+                line = (sprite_height - 1) - line;
             }
             
             // get tile data address
@@ -441,11 +1033,11 @@ void ppu_render_scanline(ppu *ppu) {
                 // mask off bit 0 for 8x16 sprites
                 adjusted_tile_num &= 0xFE;  // clear lowest bit
             }
-            uint16_t tile_addr = 0x8000 + (adjusted_tile_num * 16) + (line * 2);
             
             // get tile data
-            uint8_t byte1 = ppu->vram[tile_addr - VRAM_START];
-            uint8_t byte2 = ppu->vram[(tile_addr + 1) - VRAM_START];
+            const uint8_t *row = &vram[(adjusted_tile_num * 16) + (line * 2)];
+            uint8_t byte1 = row[0];
+            uint8_t byte2 = row[1];
             
             // draw all pixels for this line of the sprite
             for (int x = 0; x < 8; x++) {
@@ -459,8 +1051,7 @@ void ppu_render_scanline(ppu *ppu) {
                     // only draw non-transparent (opaque) pixels
                     if (color > 0) {
                         // apply sprite palette
-                        uint8_t palette = bus_read8(ppu->bus, sprite->flags & 0x10 ? OBP1 : OBP0);
-                        color = (palette >> (color * 2)) & 3;
+                        color = palette[color];
                         
                         // check sprite to background priority
                         if (!(sprite->flags & 0x80) || scanline[pixel_x] == 0) {
@@ -473,6 +1064,42 @@ void ppu_render_scanline(ppu *ppu) {
     }
 }
 
+// one renderer per combination of the specialized lcdc bits
+#define PPU_RENDER_VARIANT(index) \
+    static void ppu_render_line_##index(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly) { \
+        ppu_render_line(ppu, frame_log, ly, PPU_RENDER_LCDC(index)); \
+    }
+#define PPU_RENDER_VARIANTS_8(base) \
+    PPU_RENDER_VARIANT(base ## 0) PPU_RENDER_VARIANT(base ## 1) \
+    PPU_RENDER_VARIANT(base ## 2) PPU_RENDER_VARIANT(base ## 3) \
+    PPU_RENDER_VARIANT(base ## 4) PPU_RENDER_VARIANT(base ## 5) \
+    PPU_RENDER_VARIANT(base ## 6) PPU_RENDER_VARIANT(base ## 7)
+
+// octal indices 000-037
+PPU_RENDER_VARIANTS_8(00)
+PPU_RENDER_VARIANTS_8(01)
+PPU_RENDER_VARIANTS_8(02)
+PPU_RENDER_VARIANTS_8(03)
+
+#define PPU_RENDER_ENTRIES_8(base) \
+    ppu_render_line_##base##0, ppu_render_line_##base##1, \
+    ppu_render_line_##base##2, ppu_render_line_##base##3, \
+    ppu_render_line_##base##4, ppu_render_line_##base##5, \
+    ppu_render_line_##base##6, ppu_render_line_##base##7
+
+static void (*const ppu_line_renderers[32])(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly) = {
+    PPU_RENDER_ENTRIES_8(00),
+    PPU_RENDER_ENTRIES_8(01),
+    PPU_RENDER_ENTRIES_8(02),
+    PPU_RENDER_ENTRIES_8(03),
+};
+
+// drawing (mode 3), picks the renderer for this line's lcdc once
+void ppu_render_scanline(ppu *ppu, ppu_frame_log *frame_log, uint8_t ly) {
+    ppu_line_renderers[PPU_RENDER_INDEX(frame_log->regs.lcdc)](ppu, frame_log, ly);
+    ppu_output_line(ppu, ly);
+}
+
 // h-blank (mode 0):
 // - this mode takes up the remainder of the scanline after the drawing mode 3 wraps up
 // - essentially pads the duration of the scanline to 456 t-cycles, pausing the ppu 
@@ -485,118 +1112,94 @@ void ppu_render_scanline(ppu *ppu) {
 
 
 void ppu_step(ppu *ppu) {
+    uint8_t *memory = ppu->bus->memory;
 
-    // printf("PPU mode=%d cycles=%d ly=%d LCD=%s\n", 
-    //    ppu->mode, ppu->dot_counter, ppu->current_ly,
-    //    (bus_read8(ppu->bus, LCDC) & LCDC_ENABLE) ? "ON" : "OFF");
+    if (!(memory[LCDC] & LCDC_ENABLE)) {
+        if (ppu->lcd_enabled) {
+            ppu->lcd_enabled = false;
 
-    if (!(bus_read8(ppu->bus, LCDC) & LCDC_ENABLE)) {
-        // ppu->window_line_counter = 0;
-        // return;
+            // draw whatever was finished before the lcd went off
+            if (ppu->log_active) {
+                ppu_submit(ppu, false);
+            }
+            ppu->skipping = false;
 
-        ppu->window_line_counter = 0;
-        ppu->current_ly = 0;
-        ppu->mode = MODE_HBLANK; // mode 0
-        
-        // update LY register and mode bits in STAT
-        bus_write8(ppu->bus, LY, 0);
-        uint8_t stat = bus_read8(ppu->bus, STAT);
-        bus_write8(ppu->bus, STAT, (stat & 0xFC) | MODE_HBLANK);
-        
-        // clear LCD interrupts (bits 0-2 in IF)
-        uint8_t if_reg = bus_read8(ppu->bus, 0xFF0F);
-        bus_write8(ppu->bus, 0xFF0F, if_reg & ~0x03);
-        
+            // LY reads 0 and STAT reports hblank while the lcd is off
+            ppu_set_mode(ppu, MODE_HBLANK, 0);
+
+            // clear LCD interrupts (bits 0-1 in IF)
+            memory[0xFF0F] &= ~0x03;
+        }
         return;
     }
-    
-    // ppu->dot_counter++;
-    // ppu_check_stat_interrupts(ppu);
+
+    if (!ppu->lcd_enabled) {
+        ppu->lcd_enabled = true;
+        ppu_check_stat_interrupts(ppu);
+    }
+
+    // new frame (or lcd just turned on), snapshot video state before any line is drawn
+    // a skipped frame takes no snapshot and logs nothing, the dirty bits carry over to the next one
+    if (!ppu->log_active && !ppu->skipping && ppu->current_ly < SCREEN_HEIGHT) {
+        if (ppu->skip_frame) {
+            ppu->skipping = true;
+        } else {
+            ppu_begin_frame(ppu);
+        }
+    }
 
     switch(ppu->mode) {
         case MODE_OAM_SCAN:
             if (ppu->dot_counter >= 80) {
-                // do at end of oam scan as some flags are set during OAM mode
-                ppu_oam_scan(ppu);
-                ppu->mode = MODE_DRAWING;
+                // sprites are picked when the line is rendered
                 ppu->dot_counter = 0;
-                // Update STAT mode bits first
-                uint8_t stat = bus_read8(ppu->bus, STAT);
-                bus_write8(ppu->bus, STAT, (stat & 0xFC) | ppu->mode);
-                // ppu_check_stat_interrupts(ppu);
+                ppu_set_mode(ppu, MODE_DRAWING, ppu->current_ly);
             }
-            ppu_check_stat_interrupts(ppu);
             break;
 
         case MODE_DRAWING:
             if (ppu->dot_counter >= 172) {
-                ppu_render_scanline(ppu);
-                ppu->mode = MODE_HBLANK;
+                // line is drawn later from the snapshot and log
+                if (ppu->log_active) {
+                    ppu->frame_log->last_line = ppu->current_ly + 1;
+                }
                 ppu->dot_counter = 0;
-                // Update STAT mode bits first
-                uint8_t stat = bus_read8(ppu->bus, STAT);
-                bus_write8(ppu->bus, STAT, (stat & 0xFC) | ppu->mode);
-                // ppu_check_stat_interrupts(ppu);
+                ppu_set_mode(ppu, MODE_HBLANK, ppu->current_ly);
             }
-            ppu_check_stat_interrupts(ppu);
             break;
 
         case MODE_HBLANK:
             if (ppu->dot_counter >= 456 - (80 + 172)) {
-                ppu->current_ly++;
                 ppu->dot_counter = 0;
                 
-                if (ppu->current_ly == 144) {
-                    ppu->mode = MODE_VBLANK;
-                    // Set both the mode bits and request VBLANK interrupt
-                    uint8_t stat = bus_read8(ppu->bus, STAT);
-                    bus_write8(ppu->bus, STAT, (stat & 0xFC) | ppu->mode);
-                    uint8_t if_reg = bus_read8(ppu->bus, 0xFF0F);
-                    bus_write8(ppu->bus, 0xFF0F, if_reg | 0x01);
-                    // ppu_check_stat_interrupts(ppu);
+                if (ppu->current_ly + 1 == 144) {
+                    // render the whole frame in one pass, the sink gets it once it's drawn
+                    if (ppu->log_active) {
+                        ppu_submit(ppu, true);
+                    }
+                    ppu->skipping = false;
+
+                    // request VBLANK interrupt
+                    memory[0xFF0F] |= 0x01;
+                    ppu_set_mode(ppu, MODE_VBLANK, 144);
+                    ppu->frame_count++;
                 } else {
-                    ppu->mode = MODE_OAM_SCAN;
-                    // Update STAT mode bits first
-                    uint8_t stat = bus_read8(ppu->bus, STAT);
-                    bus_write8(ppu->bus, STAT, (stat & 0xFC) | ppu->mode);
-                    // ppu_check_stat_interrupts(ppu);
+                    ppu_set_mode(ppu, MODE_OAM_SCAN, ppu->current_ly + 1);
                 }
             }
-            ppu_check_stat_interrupts(ppu);
             break;
 
         case MODE_VBLANK:
             if (ppu->dot_counter >= 456) {
                 ppu->dot_counter = 0;
-                ppu->current_ly++;
-                //ppu_check_stat_interrupts(ppu);
-
-                if (ppu->current_ly >= 154) {
-
-                    ppu->window_line_counter = 0;
 
-                    if (ppu->frame_complete_callback) {
-                        ppu->frame_complete_callback(ppu->screen_buffer);
-                    }
-                    
-                    ppu->current_ly = 0;
-                    ppu->mode = MODE_OAM_SCAN;
-                    memset(ppu->screen_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
-                    // Update STAT mode bits first
-                    uint8_t stat = bus_read8(ppu->bus, STAT);
-                    bus_write8(ppu->bus, STAT, (stat & 0xFC) | ppu->mode);
-                    // ppu_check_stat_interrupts(ppu);
-                    
+                if (ppu->current_ly + 1 >= 154) {
+                    // window counter and screen buffer are reset by the renderer
+                    ppu_set_mode(ppu, MODE_OAM_SCAN, 0);
+                } else {
+                    ppu_set_mode(ppu, MODE_VBLANK, ppu->current_ly + 1);
                 }
-                // ppu_check_stat_interrupts(ppu);
             }
-            ppu_check_stat_interrupts(ppu);
             break;
     }
-
-    if (ppu->current_ly != bus_read8(ppu->bus, LY)) {
-        // printf("writing ly=%d to memory\n", ppu->current_ly);
-        bus_write8(ppu->bus, LY, ppu->current_ly);
-    }
-
-}
\ No newline at end of file
+}
@@ -0,0 +1,251 @@
+#include "../include/rewind.h"
+#include "../include/state.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// delta encoding
+// a run of unchanged bytes and then a run of literal xor bytes, repeated to the end:
+//   [zero count][literal count][literals]
+// counts are little endian base 128 varints. a literal run ends at two unchanged bytes in a
+// row, so lone matching bytes don't cost a new pair of counts
+#define REWIND_RECORD_OVERHEAD (2 * sizeof(uint32_t))
+
+static inline uint8_t *rewind_put_varint(uint8_t *out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline const uint8_t *rewind_get_varint(const uint8_t *in, const uint8_t *end, size_t *value) {
+    size_t result = 0;
+    int shift = 0;
+    while (in < end) {
+        uint8_t byte = *in++;
+        result |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    *value = result;
+    return in;
+}
+
+// worst case is a varint pair per 3 bytes of input (x 0 0 x 0 0 ...)
+static size_t rewind_packed_bound(size_t size) {
+    return size + size / 3 * 2 + 16;
+}
+
+// encode a ^ b into out, returns the encoded size
+static size_t rewind_encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out) {
+    uint8_t *start = out;
+    size_t i = 0;
+
+    while (i < size) {
+        // unchanged run, 8 bytes at a time while it lasts
+        size_t zeros = i;
+        while (i + 8 <= size) {
+            uint64_t x, y;
+            memcpy(&x, a + i, 8);
+            memcpy(&y, b + i, 8);
+            if (x != y) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < size && a[i] == b[i]) {
+            i++;
+        }
+        zeros = i - zeros;
+        if (i == size) {
+            if (zeros > 0) {
+                out = rewind_put_varint(out, zeros);
+                out = rewind_put_varint(out, 0);
+            }
+            break;
+        }
+
+        size_t literal = i;
+        while (i < size && !(a[i] == b[i] && (i + 1 == size || a[i + 1] == b[i + 1]))) {
+            i++;
+        }
+        out = rewind_put_varint(out, zeros);
+        out = rewind_put_varint(out, i - literal);
+        for (size_t j = literal; j < i; j++) {
+            *out++ = a[j] ^ b[j];
+        }
+    }
+    return out - start;
+}
+
+// xor an encoded delta into target
+static void rewind_apply(const uint8_t *packed, size_t packed_size, uint8_t *target, size_t size) {
+    const uint8_t *in = packed;
+    const uint8_t *end = packed + packed_size;
+    size_t pos = 0;
+
+    while (in < end) {
+        size_t zeros, literal;
+        in = rewind_get_varint(in, end, &zeros);
+        in = rewind_get_varint(in, end, &literal);
+        pos += zeros;
+        if (literal > (size_t)(end - in) || pos + literal > size) {
+            // can't happen unless the ring is corrupt
+            fprintf(stderr, "rewind delta is corrupt\n");
+            return;
+        }
+        for (size_t j = 0; j < literal; j++) {
+            target[pos + j] ^= in[j];
+        }
+        in += literal;
+        pos += literal;
+    }
+}
+
+// ring helpers, data may wrap around the end
+static void rewind_ring_write(gb_rewind *rewind, size_t pos, const void *data, size_t size) {
+    size_t first = rewind->capacity - pos;
+    if (first >= size) {
+        memcpy(rewind->ring + pos, data, size);
+    } else {
+        memcpy(rewind->ring + pos, data, first);
+        memcpy(rewind->ring, (const uint8_t *)data + first, size - first);
+    }
+}
+
+static void rewind_ring_read(const gb_rewind *rewind, size_t pos, void *data, size_t size) {
+    size_t first = rewind->capacity - pos;
+    if (first >= size) {
+        memcpy(data, rewind->ring + pos, size);
+    } else {
+        memcpy(data, rewind->ring + pos, first);
+        memcpy((uint8_t *)data + first, rewind->ring, size - first);
+    }
+}
+
+static inline size_t rewind_ring_pos(const gb_rewind *rewind, size_t pos, size_t offset) {
+    return (pos + offset) % rewind->capacity;
+}
+
+static void rewind_drop_oldest(gb_rewind *rewind) {
+    size_t tail = rewind_ring_pos(rewind, rewind->head, rewind->capacity - rewind->used);
+    uint32_t size;
+    rewind_ring_read(rewind, tail, &size, sizeof(size));
+    rewind->used -= size + REWIND_RECORD_OVERHEAD;
+    rewind->count--;
+}
+
+gb_rewind *gb_rewind_create(const gb *gb, size_t budget, uint32_t interval) {
+    gb_rewind *rewind = calloc(1, sizeof(*rewind));
+    if (rewind == NULL) {
+        fprintf(stderr, "Failed to allocate memory for rewind\n");
+        return NULL;
+    }
+    rewind->capacity = budget;
+    rewind->state_size = gb_state_size(gb);
+    rewind->interval = interval > 0 ? interval : 1;
+
+    rewind->ring = malloc(budget > 0 ? budget : 1);
+    rewind->current = malloc(rewind->state_size);
+    rewind->state = malloc(rewind->state_size);
+    rewind->packed = malloc(rewind_packed_bound(rewind->state_size));
+    if (rewind->ring == NULL || rewind->current == NULL || rewind->state == NULL || rewind->packed == NULL) {
+        fprintf(stderr, "Failed to allocate memory for rewind\n");
+        gb_rewind_destroy(rewind);
+        return NULL;
+    }
+    return rewind;
+}
+
+void gb_rewind_destroy(gb_rewind *rewind) {
+    if (rewind == NULL) {
+        return;
+    }
+    free(rewind->ring);
+    free(rewind->current);
+    free(rewind->state);
+    free(rewind->packed);
+    free(rewind);
+}
+
+void gb_rewind_clear(gb_rewind *rewind) {
+    rewind->head = 0;
+    rewind->used = 0;
+    rewind->count = 0;
+    rewind->have_current = false;
+    rewind->frames = 0;
+}
+
+void gb_rewind_push(gb_rewind *rewind, const gb *gb) {
+    if (gb_save_state(gb, rewind->state, rewind->state_size) == 0) {
+        // rom changed under us, the old history is no use
+        gb_rewind_clear(rewind);
+        return;
+    }
+
+    if (rewind->have_current) {
+        // the delta takes the new state back to the previous one
+        uint32_t size = (uint32_t)rewind_encode(rewind->state, rewind->current, rewind->state_size, rewind->packed);
+        size_t record = size + REWIND_RECORD_OVERHEAD;
+
+        if (record > rewind->capacity) {
+            // the chain back is broken, start over from this state
+            rewind->head = 0;
+            rewind->used = 0;
+            rewind->count = 0;
+        } else {
+            while (rewind->capacity - rewind->used < record) {
+                rewind_drop_oldest(rewind);
+            }
+            size_t pos = rewind->head;
+            rewind_ring_write(rewind, pos, &size, sizeof(size));
+            rewind_ring_write(rewind, rewind_ring_pos(rewind, pos, sizeof(size)), rewind->packed, size);
+            rewind_ring_write(rewind, rewind_ring_pos(rewind, pos, sizeof(size) + size), &size, sizeof(size));
+            rewind->head = rewind_ring_pos(rewind, pos, record);
+            rewind->used += record;
+            rewind->count++;
+        }
+    }
+
+    uint8_t *swap = rewind->current;
+    rewind->current = rewind->state;
+    rewind->state = swap;
+    rewind->have_current = true;
+}
+
+void gb_rewind_frame(gb_rewind *rewind, const gb *gb) {
+    if (++rewind->frames >= rewind->interval) {
+        rewind->frames = 0;
+        gb_rewind_push(rewind, gb);
+    }
+}
+
+int gb_rewind_pop(gb_rewind *rewind, gb *gb) {
+    if (!rewind->have_current) {
+        return -1;
+    }
+    if (gb_load_state(gb, rewind->current, rewind->state_size) != 0) {
+        gb_rewind_clear(rewind);
+        return -1;
+    }
+    rewind->frames = 0;
+
+    if (rewind->count > 0) {
+        uint32_t size;
+        size_t end = rewind_ring_pos(rewind, rewind->head, rewind->capacity - sizeof(size));
+        rewind_ring_read(rewind, end, &size, sizeof(size));
+        size_t record = size + REWIND_RECORD_OVERHEAD;
+        size_t start = rewind_ring_pos(rewind, rewind->head, rewind->capacity - record);
+        rewind_ring_read(rewind, rewind_ring_pos(rewind, start, sizeof(size)), rewind->packed, size);
+
+        rewind->head = start;
+        rewind->used -= record;
+        rewind->count--;
+        rewind_apply(rewind->packed, size, rewind->current, rewind->state_size);
+    }
+    return 0;
+}
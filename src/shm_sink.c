@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shm_sink.h"
+#include "../include/gb.h"
+#include "../include/bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// start of a frame, hand the renderer the pixels of the next slot
+// the sequence goes odd first so readers skip the slot while it's overwritten
+static void *shm_sink_begin_frame(void *user, int *pitch) {
+    shm_sink *sink = user;
+    shm_frame_slot *slot = &sink->ring->slots[sink->frame % SHM_SINK_SLOTS];
+
+    uint32_t sequence = __atomic_load_n(&slot->header.sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->header.sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    sink->slot = slot;
+    *pitch = SCREEN_WIDTH;
+    return slot->pixels;
+}
+
+// frame is drawn, stamp the header and publish
+static void shm_sink_end_frame(void *user, uint8_t *buffer, void *pixels) {
+    (void)buffer;
+    (void)pixels;
+    shm_sink *sink = user;
+    shm_frame_slot *slot = sink->slot;
+    cpu *cpu = &sink->gb->cpu;
+    uint8_t *memory = cpu->bus.memory;
+    shm_frame_header *header = &slot->header;
+
+    header->frame = sink->frame;
+    header->cycles = cpu->count;
+    memcpy(header->lcd_registers, &memory[0xFF40], sizeof(header->lcd_registers));
+    header->interrupt_flag = memory[0xFF0F];
+    header->interrupt_enable = memory[0xFFFF];
+    header->a = cpu->registers.a;
+    header->f = flags_register_to_byte(cpu->registers.f);
+    header->b = cpu->registers.b;
+    header->c = cpu->registers.c;
+    header->d = cpu->registers.d;
+    header->e = cpu->registers.e;
+    header->h = cpu->registers.h;
+    header->l = cpu->registers.l;
+    header->sp = cpu->registers.sp;
+    header->pc = cpu->registers.pc;
+
+    // even again once everything above is visible
+    uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&sink->ring->frames, sink->frame + 1, __ATOMIC_RELEASE);
+
+    sink->frame++;
+    sink->slot = NULL;
+}
+
+shm_sink *shm_sink_create(const char *name, gb *gb) {
+    if (gb->ppu.render_thread_active) {
+        fprintf(stderr, "shm sink needs frames drawn inline, stop the render thread first\n");
+        return NULL;
+    }
+
+    shm_sink *sink = calloc(1, sizeof(shm_sink));
+    if (sink == NULL) {
+        fprintf(stderr, "Failed to allocate memory for shm sink\n");
+        return NULL;
+    }
+    snprintf(sink->name, sizeof(sink->name), "/%s", name[0] == '/' ? name + 1 : name);
+
+    int fd = shm_open(sink->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        free(sink);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(shm_ring)) < 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(sink->name);
+        free(sink);
+        return NULL;
+    }
+    sink->ring = mmap(NULL, sizeof(shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sink->ring == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(sink->name);
+        free(sink);
+        return NULL;
+    }
+
+    // fresh object is zeroed, so every sequence starts even
+    shm_ring *ring = sink->ring;
+    ring->version = SHM_SINK_VERSION;
+    ring->slot_count = SHM_SINK_SLOTS;
+    ring->width = SCREEN_WIDTH;
+    ring->height = SCREEN_HEIGHT;
+    ring->frames = 0;
+    __atomic_store_n(&ring->magic, SHM_SINK_MAGIC, __ATOMIC_RELEASE);
+
+    sink->gb = gb;
+
+    // shades straight into the slot, 1 byte per pixel through an identity palette
+    ppu_output_sink output = {0};
+    output.user = sink;
+    output.begin_frame = shm_sink_begin_frame;
+    output.end_frame = shm_sink_end_frame;
+    output.bytes_per_pixel = 1;
+    for (int i = 0; i < 4; i++) {
+        output.palette[i] = i;
+    }
+    ppu_set_output_sink(&gb->ppu, &output);
+    return sink;
+}
+
+void shm_sink_destroy(shm_sink *sink) {
+    if (sink == NULL) {
+        return;
+    }
+    ppu_set_output_sink(&sink->gb->ppu, NULL);
+    munmap(sink->ring, sizeof(shm_ring));
+    shm_unlink(sink->name);
+    free(sink);
+}
+
+const shm_ring *shm_ring_open(const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/%s", name[0] == '/' ? name + 1 : name);
+
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(shm_ring)) {
+        fprintf(stderr, "%s is not a frame ring\n", path);
+        close(fd);
+        return NULL;
+    }
+    const shm_ring *ring = mmap(NULL, sizeof(shm_ring), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SHM_SINK_MAGIC || ring->version != SHM_SINK_VERSION) {
+        fprintf(stderr, "%s is not a version %d frame ring\n", path, SHM_SINK_VERSION);
+        munmap((void *)ring, sizeof(shm_ring));
+        return NULL;
+    }
+    return ring;
+}
+
+void shm_ring_close(const shm_ring *ring) {
+    if (ring != NULL) {
+        munmap((void *)ring, sizeof(shm_ring));
+    }
+}
+
+int64_t shm_ring_read_latest(const shm_ring *ring, shm_frame_header *header, uint8_t *pixels) {
+    for (;;) {
+        uint32_t frames = __atomic_load_n(&ring->frames, __ATOMIC_ACQUIRE);
+        if (frames == 0) {
+            return -1;
+        }
+        const shm_frame_slot *slot = &ring->slots[(frames - 1) % SHM_SINK_SLOTS];
+
+        uint32_t before = __atomic_load_n(&slot->header.sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;   // writer lapped us and is in this slot right now
+        }
+        shm_frame_header copy;
+        memcpy(&copy, &slot->header, sizeof(shm_frame_header));
+        if (pixels != NULL) {
+            memcpy(pixels, slot->pixels, sizeof(slot->pixels));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t after = __atomic_load_n(&slot->header.sequence, __ATOMIC_RELAXED);
+        if (before != after) {
+            continue;
+        }
+
+        // the slot may already hold a newer frame than the one counted, the header says which
+        copy.sequence = before;
+        if (header != NULL) {
+            *header = copy;
+        }
+        return copy.frame;
+    }
+}
@@ -0,0 +1,686 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/socket_link.h"
+#include "../include/state.h"
+#include "../include/cpu.h"
+#include "../include/bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// timelines
+// index 0 of ours and theirs is the port as the link came up, it's never taken back
+
+static int gb_socket_link_push(gb_socket_link_log *log, const gb_socket_link_event *event) {
+    if (log->count == log->capacity) {
+        size_t capacity = log->capacity > 0 ? log->capacity * 2 : 256;
+        gb_socket_link_event *events = realloc(log->events, capacity * sizeof(gb_socket_link_event));
+        if (events == NULL) {
+            fprintf(stderr, "Failed to allocate memory for link\n");
+            return -1;
+        }
+        log->events = events;
+        log->capacity = capacity;
+    }
+    log->events[log->count++] = *event;
+    return 0;
+}
+
+// first event at or after time
+static size_t gb_socket_link_find(const gb_socket_link_log *log, uint64_t time) {
+    size_t low = 0;
+    size_t high = log->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (log->events[mid].time < time) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// the port as it stood before the instruction starting at time
+static const gb_socket_link_event *gb_socket_link_port_before(const gb_socket_link_log *log, uint64_t time) {
+    size_t i = gb_socket_link_find(log, time);
+    while (i > 1 && log->events[i - 1].type != GB_LINK_PORT) {
+        i--;
+    }
+    return &log->events[i > 0 ? i - 1 : 0];
+}
+
+static inline bool gb_socket_link_listening(const gb_socket_link_event *port) {
+    return (port->sc & 0x81) == 0x80;
+}
+
+// what our transfer finishing at time gets: their byte if they were listening, else an empty port
+static uint8_t gb_socket_link_their_byte(const gb_socket_link *link, uint64_t time) {
+    const gb_socket_link_event *port = gb_socket_link_port_before(&link->theirs, time);
+    return gb_socket_link_listening(port) ? port->sb : 0xFF;
+}
+
+static bool gb_socket_link_has(const gb_socket_link_log *log, uint64_t time, uint8_t type, int sb) {
+    for (size_t i = gb_socket_link_find(log, time); i < log->count && log->events[i].time == time; i++) {
+        if (log->events[i].type == type && (sb < 0 || log->events[i].sb == sb)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// drop what no rollback can reach any more, keeping the port as it stood. keep is the first
+// index still in use
+static size_t gb_socket_link_prune(gb_socket_link_log *log, uint64_t time, size_t keep, bool port) {
+    size_t end = gb_socket_link_find(log, time);
+    if (end > keep) {
+        end = keep;
+    }
+    size_t start = 0;
+    if (port && end > 0) {
+        const gb_socket_link_event *last = gb_socket_link_port_before(log, log->events[end - 1].time + 1);
+        log->events[0] = *last;
+        start = 1;
+    }
+    if (end <= start) {
+        return 0;
+    }
+    memmove(&log->events[start], &log->events[end], (log->count - end) * sizeof(gb_socket_link_event));
+    log->count -= end - start;
+    return end - start;
+}
+
+// socket
+
+static void gb_socket_link_lost(gb_socket_link *link) {
+    // the other side closing once both are settled is the normal end
+    if (!link->settling) {
+        fprintf(stderr, "link: the other side has gone\n");
+    }
+    close(link->fd);
+    link->fd = -1;
+}
+
+// events that change their timeline are counted, so the ends can tell when both have
+// everything
+static void gb_socket_link_queue(gb_socket_link *link, const gb_socket_link_event *event) {
+    if (event->type != GB_LINK_TIME && event->type != GB_LINK_DONE) {
+        link->sent++;
+    }
+    gb_socket_link_push(&link->out, event);
+}
+
+static void gb_socket_link_send(gb_socket_link *link, uint8_t type, uint64_t time, uint8_t sb, uint8_t sc) {
+    gb_socket_link_event event;
+    memset(&event, 0, sizeof(event));
+    event.time = time;
+    event.type = type;
+    event.sb = sb;
+    event.sc = sc;
+    gb_socket_link_queue(link, &event);
+}
+
+static void gb_socket_link_check(gb_socket_link *link, uint64_t changed);
+
+static void gb_socket_link_take(gb_socket_link *link, const gb_socket_link_event *event, uint64_t *changed) {
+    switch (event->type) {
+        case GB_LINK_PORT:
+        case GB_LINK_TRANSFER:
+            gb_socket_link_push(&link->theirs, event);
+            if (event->time > link->their_time) {
+                link->their_time = event->time;
+            }
+            break;
+        case GB_LINK_RETRACT: {
+            size_t count = gb_socket_link_find(&link->theirs, event->time);
+            link->theirs.count = count > 1 ? count : 1;
+            if (link->theirs_next > link->theirs.count) {
+                link->theirs_next = link->theirs.count;
+            }
+            // they went back to before here
+            if (link->their_time > event->time) {
+                link->their_time = event->time;
+            }
+            break;
+        }
+        case GB_LINK_TIME:
+            if (event->time > link->their_time) {
+                link->their_time = event->time;
+            }
+            return;
+        case GB_LINK_DONE:
+            link->their_done = event->time;
+            link->their_done_seen = true;
+            return;
+        default:
+            return;
+    }
+    link->received++;
+    if (event->time < *changed) {
+        *changed = event->time;
+    }
+}
+
+// read whatever has arrived, then roll back if it changes what already ran
+static void gb_socket_link_receive(gb_socket_link *link) {
+    uint64_t changed = UINT64_MAX;
+    while (link->fd >= 0) {
+        ssize_t n = recv(link->fd, link->in + link->in_size, sizeof(link->in) - link->in_size, 0);
+        if (n > 0) {
+            link->in_size += n;
+            size_t whole = link->in_size / sizeof(gb_socket_link_event);
+            for (size_t i = 0; i < whole; i++) {
+                gb_socket_link_event event;
+                memcpy(&event, link->in + i * sizeof(event), sizeof(event));
+                gb_socket_link_take(link, &event, &changed);
+            }
+            link->in_size -= whole * sizeof(gb_socket_link_event);
+            memmove(link->in, link->in + whole * sizeof(gb_socket_link_event), link->in_size);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        gb_socket_link_lost(link);
+    }
+    if (changed != UINT64_MAX) {
+        gb_socket_link_check(link, changed);
+    }
+}
+
+// send everything queued and how far we've got
+static void gb_socket_link_flush(gb_socket_link *link) {
+    if (link->fd < 0) {
+        link->out.count = 0;
+        return;
+    }
+
+    // how far we've got goes along with any news, or on its own once a frame
+    if (link->out.count == 0 && link->time < link->time_sent + GB_CYCLES_PER_FRAME) {
+        return;
+    }
+    gb_socket_link_send(link, GB_LINK_TIME, link->time, 0, 0);
+    link->time_sent = link->time;
+
+    const uint8_t *data = (const uint8_t *)link->out.events;
+    size_t size = link->out.count * sizeof(gb_socket_link_event);
+    size_t sent = 0;
+    while (sent < size && link->fd >= 0) {
+        ssize_t n = send(link->fd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // keep reading while their buffer drains, so both sides can't fill up at once
+            gb_socket_link_receive(link);
+            struct pollfd pfd = { link->fd, POLLIN | POLLOUT, 0 };
+            poll(&pfd, 1, 100);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            gb_socket_link_lost(link);
+        }
+    }
+    link->out.count = 0;
+}
+
+// rollback
+
+static void gb_socket_link_snapshot_take(gb_socket_link *link) {
+    gb_socket_link_snapshot *snapshot = &link->snapshots[link->snapshot_head];
+    gb_save_state(link->gb, snapshot->state, link->state_size);
+    snapshot->time = link->time;
+    snapshot->prev = link->prev;
+    snapshot->frames = link->frames;
+    snapshot->frame_start = link->frame_start;
+    link->snapshot_head = (link->snapshot_head + 1) % GB_SOCKET_LINK_HISTORY;
+    link->snapshot_frame = link->frames;
+    if (link->snapshot_count < GB_SOCKET_LINK_HISTORY) {
+        link->snapshot_count++;
+        return;
+    }
+
+    // history is full, nothing can roll back past the oldest state any more
+    uint64_t oldest = link->snapshots[link->snapshot_head].prev;
+    size_t removed = gb_socket_link_prune(&link->theirs, oldest, link->theirs_next, true);
+    link->theirs_next -= removed;
+    removed = gb_socket_link_prune(&link->ours, oldest, link->replay, true);
+    link->replay -= removed;
+    removed = gb_socket_link_prune(&link->input, oldest, link->input_next, false);
+    link->input_next -= removed;
+    removed = gb_socket_link_prune(&link->used, oldest, link->used.count, false);
+    link->transfers += removed;
+}
+
+// newest state from before time, loaded, with everything after it to be run again
+static void gb_socket_link_rollback(gb_socket_link *link, uint64_t time) {
+    gb *gb = link->gb;
+    uint32_t back = 0;
+    while (back + 1 < link->snapshot_count) {
+        uint32_t slot = (link->snapshot_head + GB_SOCKET_LINK_HISTORY - 1 - back) % GB_SOCKET_LINK_HISTORY;
+        if (link->snapshots[slot].prev < time) {
+            break;
+        }
+        back++;
+    }
+    uint32_t slot = (link->snapshot_head + GB_SOCKET_LINK_HISTORY - 1 - back) % GB_SOCKET_LINK_HISTORY;
+    gb_socket_link_snapshot *snapshot = &link->snapshots[slot];
+    if (snapshot->prev >= time && time > 0) {
+        fprintf(stderr, "link: news from cycle %llu is older than the history, the sides may disagree\n",
+                (unsigned long long)time);
+    }
+
+    // frames up to here were shown already
+    if (!link->redoing || link->frames > link->redo_frame) {
+        link->redo_frame = link->frames;
+    }
+    link->redoing = true;
+
+    if (gb_load_state(gb, snapshot->state, link->state_size) != 0) {
+        return;
+    }
+    link->replayed += link->time - snapshot->time;
+    link->snapshot_head = (slot + 1) % GB_SOCKET_LINK_HISTORY;
+    link->snapshot_count -= back;
+    gb->ppu.skip_frame = true;
+
+    link->time = snapshot->time;
+    link->prev = snapshot->prev;
+    link->frames = snapshot->frames;
+    link->frame_start = snapshot->frame_start;
+    link->snapshot_frame = link->frames;
+    link->last_count = gb->cpu.count;
+    link->next_poll = link->time + GB_SOCKET_LINK_POLL;
+
+    // everything from the instruction at the snapshot on happens again
+    size_t replay = gb_socket_link_find(&link->ours, snapshot->time);
+    link->replay = replay > 1 ? replay : 1;
+    link->used.count = gb_socket_link_find(&link->used, snapshot->prev + 1);
+    link->theirs_next = gb_socket_link_find(&link->theirs, snapshot->prev + 1);
+    link->input_next = gb_socket_link_find(&link->input, snapshot->prev + 1);
+    link->port_sb = gb->cpu.bus.memory[0xFF01];
+    link->port_sc = gb->cpu.bus.memory[0xFF02] & 0x81;
+    link->rollbacks++;
+}
+
+// their timeline changed from changed on, find the first thing we ran that it contradicts
+static void gb_socket_link_check(gb_socket_link *link, uint64_t changed) {
+    uint64_t bad = UINT64_MAX;
+
+    // bytes we took from them
+    for (size_t i = gb_socket_link_find(&link->used, changed); i < link->used.count; i++) {
+        const gb_socket_link_event *used = &link->used.events[i];
+        if (used->type == GB_LINK_SENT) {
+            if (used->time > changed && gb_socket_link_their_byte(link, used->time) != used->sb) {
+                bad = used->time;
+                break;
+            }
+        } else if (!gb_socket_link_has(&link->theirs, used->time, GB_LINK_TRANSFER, used->sb)) {
+            bad = used->time;
+            break;
+        }
+    }
+
+    // transfers of theirs that should have landed while we were listening, but we didn't know
+    for (size_t i = gb_socket_link_find(&link->theirs, changed); i < link->theirs.count; i++) {
+        const gb_socket_link_event *event = &link->theirs.events[i];
+        if (event->time > link->prev || event->time >= bad) {
+            break;
+        }
+        if (event->type == GB_LINK_TRANSFER &&
+            !gb_socket_link_has(&link->used, event->time, GB_LINK_RECEIVED, -1) &&
+            gb_socket_link_listening(gb_socket_link_port_before(&link->ours, event->time))) {
+            bad = event->time;
+            break;
+        }
+    }
+
+    if (bad != UINT64_MAX) {
+        gb_socket_link_rollback(link, bad);
+    }
+}
+
+// what our port does, checked against what we sent the last time we ran this far
+static void gb_socket_link_diverge(gb_socket_link *link, uint64_t time) {
+    // matched events from time on are taken back too, send them again after
+    size_t keep = link->replay;
+    while (keep > 1 && link->ours.events[keep - 1].time >= time) {
+        keep--;
+    }
+    link->ours.count = link->replay;
+    gb_socket_link_send(link, GB_LINK_RETRACT, time, 0, 0);
+    for (size_t i = keep; i < link->replay; i++) {
+        gb_socket_link_queue(link, &link->ours.events[i]);
+    }
+}
+
+static void gb_socket_link_emit(gb_socket_link *link, uint8_t type, uint64_t time, uint8_t sb, uint8_t sc) {
+    if (link->replay < link->ours.count) {
+        const gb_socket_link_event *old = &link->ours.events[link->replay];
+        if (old->time == time && old->type == type && old->sb == sb && old->sc == sc) {
+            link->replay++;
+            return;
+        }
+        gb_socket_link_diverge(link, old->time < time ? old->time : time);
+    }
+    gb_socket_link_event event;
+    memset(&event, 0, sizeof(event));
+    event.time = time;
+    event.type = type;
+    event.sb = sb;
+    event.sc = sc;
+    gb_socket_link_push(&link->ours, &event);
+    gb_socket_link_queue(link, &event);
+    link->replay = link->ours.count;
+}
+
+static void gb_socket_link_use(gb_socket_link *link, uint8_t type, uint64_t time, uint8_t sb) {
+    gb_socket_link_event event;
+    memset(&event, 0, sizeof(event));
+    event.time = time;
+    event.type = type;
+    event.sb = sb;
+    gb_socket_link_push(&link->used, &event);
+}
+
+// stepping
+
+static void gb_socket_link_poll(gb_socket_link *link) {
+    link->next_poll = link->time + GB_SOCKET_LINK_POLL;
+    gb_socket_link_flush(link);
+    gb_socket_link_receive(link);
+
+    // too far ahead to be sure of rolling back, wait for them
+    while (link->fd >= 0 && link->time > link->their_time + (uint64_t)GB_SOCKET_LINK_LEAD * GB_CYCLES_PER_FRAME) {
+        struct pollfd pfd = { link->fd, POLLIN, 0 };
+        poll(&pfd, 1, 100);
+        gb_socket_link_receive(link);
+    }
+}
+
+static void gb_socket_link_step(gb_socket_link *link) {
+    gb *gb = link->gb;
+    bus *bus = &gb->cpu.bus;
+
+    if (link->time >= link->next_poll) {
+        gb_socket_link_poll(link);
+    }
+    if (link->frames != link->snapshot_frame) {
+        gb_socket_link_snapshot_take(link);
+    }
+    if (link->redoing && link->frames >= link->redo_frame) {
+        gb->ppu.skip_frame = link->skip_frame;
+        link->redoing = false;
+    }
+
+    uint64_t now = link->time;
+
+    // something we sent last time round didn't happen again
+    if (link->replay < link->ours.count && link->ours.events[link->replay].time < now) {
+        gb_socket_link_diverge(link, link->ours.events[link->replay].time);
+    }
+
+    // our transfer finished on the last instruction
+    if (bus->serial_due) {
+        uint8_t received = gb_socket_link_their_byte(link, now);
+        gb_socket_link_emit(link, GB_LINK_TRANSFER, now, bus->memory[0xFF01], 0);
+        gb_socket_link_use(link, GB_LINK_SENT, now, received);
+        bus_serial_complete(bus, received);
+    }
+
+    // theirs land on the first instruction at or after the cycle they finished on
+    while (link->theirs_next < link->theirs.count && link->theirs.events[link->theirs_next].time <= now) {
+        const gb_socket_link_event *event = &link->theirs.events[link->theirs_next++];
+        if (event->type == GB_LINK_TRANSFER && event->time > link->prev &&
+            (bus->memory[0xFF02] & 0x81) == 0x80) {
+            gb_socket_link_use(link, GB_LINK_RECEIVED, event->time, event->sb);
+            bus_serial_complete(bus, event->sb);
+        }
+    }
+
+    while (link->input_next < link->input.count && link->input.events[link->input_next].time <= now) {
+        gb_set_joypad(gb, link->input.events[link->input_next++].sb);
+    }
+
+    // then run freely up to the next thing the link has to look at
+    uint64_t until = link->next_poll;
+    if (link->theirs_next < link->theirs.count && link->theirs.events[link->theirs_next].time < until) {
+        until = link->theirs.events[link->theirs_next].time;
+    }
+    if (link->input_next < link->input.count && link->input.events[link->input_next].time < until) {
+        until = link->input.events[link->input_next].time;
+    }
+    uint64_t frames = link->frames;
+    do {
+        uint32_t frame = gb->ppu.frame_count;
+        now = link->time;
+        gb_step(gb);
+        link->prev = now;
+        link->time += (uint32_t)(gb->cpu.count - link->last_count);
+        link->last_count = gb->cpu.count;
+
+        // frame ends as gb_run_frame has them, counted on the timeline so a rollback takes
+        // them back
+        if (gb->ppu.frame_count != frame ||
+            (!gb->ppu.lcd_enabled && link->time - link->frame_start >= GB_CYCLES_PER_FRAME)) {
+            link->frames++;
+            link->frame_start = link->time;
+        }
+
+        // port changes are stamped with the instruction that made them
+        uint8_t sb = bus->memory[0xFF01];
+        uint8_t sc = bus->memory[0xFF02] & 0x81;
+        if (sb != link->port_sb || sc != link->port_sc) {
+            link->port_sb = sb;
+            link->port_sc = sc;
+            gb_socket_link_emit(link, GB_LINK_PORT, now, sb, sc);
+        }
+    } while (link->time < until && link->frames == frames && !bus->serial_due);
+}
+
+uint32_t gb_socket_link_run_frame(gb_socket_link *link) {
+    uint64_t start = link->time;
+    if (!link->redoing) {
+        link->skip_frame = link->gb->ppu.skip_frame;
+    }
+
+    // a rollback can take the frame count back, this runs until it's past this frame again
+    link->frame_target = link->frames + 1;
+    while (link->frames < link->frame_target) {
+        gb_socket_link_step(link);
+    }
+    return link->time > start ? (uint32_t)(link->time - start) : 0;
+}
+
+void gb_socket_link_settle(gb_socket_link *link) {
+    uint64_t done = UINT64_MAX;
+    link->settling = true;
+    for (;;) {
+        while (link->frames < link->frame_target) {
+            gb_socket_link_step(link);
+        }
+
+        // what we've sent and taken, whenever that changes
+        uint64_t counts = (uint64_t)link->sent << 32 | link->received;
+        if (counts != done) {
+            gb_socket_link_send(link, GB_LINK_DONE, counts, 0, 0);
+            done = counts;
+        }
+        gb_socket_link_flush(link);
+        if (link->fd < 0) {
+            break;
+        }
+
+        // they'd taken everything we've sent and we everything they'd sent, nothing can change
+        // on either side any more. closing tells them the same
+        if (link->their_done_seen && (uint32_t)link->their_done == link->sent &&
+            (uint32_t)(link->their_done >> 32) == link->received) {
+            break;
+        }
+        struct pollfd pfd = { link->fd, POLLIN, 0 };
+        poll(&pfd, 1, 100);
+        gb_socket_link_receive(link);
+    }
+}
+
+void gb_socket_link_set_joypad(gb_socket_link *link, uint8_t buttons) {
+    gb_socket_link_event event;
+    memset(&event, 0, sizeof(event));
+    event.time = link->time;
+    event.type = GB_LINK_INPUT;
+    event.sb = buttons;
+    gb_socket_link_push(&link->input, &event);
+    link->input_next = link->input.count;
+    gb_set_joypad(link->gb, buttons);
+}
+
+// setup
+
+// swap hellos on a connected socket and set up the link
+static gb_socket_link *gb_socket_link_create(gb *gb, int fd) {
+    bus *bus = &gb->cpu.bus;
+    gb_socket_link_event hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = GB_LINK_HELLO;
+    hello.sb = bus->memory[0xFF01];
+    hello.sc = bus->memory[0xFF02] & 0x81;
+
+    gb_socket_link_event peer;
+    if (send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) ||
+        recv(fd, &peer, sizeof(peer), MSG_WAITALL) != sizeof(peer) || peer.type != GB_LINK_HELLO) {
+        fprintf(stderr, "link: no hello from the other side\n");
+        close(fd);
+        return NULL;
+    }
+
+    gb_socket_link *link = calloc(1, sizeof(gb_socket_link));
+    if (link == NULL) {
+        fprintf(stderr, "Failed to allocate memory for link\n");
+        close(fd);
+        return NULL;
+    }
+    link->gb = gb;
+    link->fd = fd;
+    link->state_size = gb_state_size(gb);
+    for (int i = 0; i < GB_SOCKET_LINK_HISTORY; i++) {
+        link->snapshots[i].state = malloc(link->state_size);
+        if (link->snapshots[i].state == NULL) {
+            fprintf(stderr, "Failed to allocate memory for link\n");
+            gb_socket_link_destroy(link);
+            return NULL;
+        }
+    }
+
+    // both ports as the link came up, at cycle 0
+    hello.type = GB_LINK_PORT;
+    peer.type = GB_LINK_PORT;
+    peer.time = 0;
+    if (gb_socket_link_push(&link->ours, &hello) != 0 || gb_socket_link_push(&link->theirs, &peer) != 0) {
+        gb_socket_link_destroy(link);
+        return NULL;
+    }
+    link->replay = 1;
+    link->theirs_next = 1;
+    link->port_sb = hello.sb;
+    link->port_sc = hello.sc;
+    link->last_count = gb->cpu.count;
+    link->next_poll = GB_SOCKET_LINK_POLL;
+    gb_socket_link_snapshot_take(link);
+
+    bus->serial_linked = true;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return link;
+}
+
+static int gb_socket_link_address(struct sockaddr_un *address, const char *path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "link: socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+gb_socket_link *gb_socket_link_listen(gb *gb, const char *path) {
+    struct sockaddr_un address;
+    if (gb_socket_link_address(&address, path) != 0) {
+        return NULL;
+    }
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        fprintf(stderr, "link: failed to create socket\n");
+        return NULL;
+    }
+    unlink(path);
+    if (bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, 1) != 0) {
+        fprintf(stderr, "link: failed to listen on %s\n", path);
+        close(server);
+        return NULL;
+    }
+
+    printf("link: waiting for the other side on %s\n", path);
+    fflush(stdout);
+    int fd = accept(server, NULL, NULL);
+    close(server);
+    unlink(path);
+    if (fd < 0) {
+        fprintf(stderr, "link: failed to accept on %s\n", path);
+        return NULL;
+    }
+    return gb_socket_link_create(gb, fd);
+}
+
+gb_socket_link *gb_socket_link_connect(gb *gb, const char *path) {
+    struct sockaddr_un address;
+    if (gb_socket_link_address(&address, path) != 0) {
+        return NULL;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "link: failed to create socket\n");
+        return NULL;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "link: failed to connect to %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    return gb_socket_link_create(gb, fd);
+}
+
+void gb_socket_link_destroy(gb_socket_link *link) {
+    if (link == NULL) {
+        return;
+    }
+    if (link->fd >= 0) {
+        gb_socket_link_flush(link);
+        close(link->fd);
+    }
+
+    // unplugged, a transfer still waiting finishes on an empty port
+    bus *bus = &link->gb->cpu.bus;
+    bus->serial_linked = false;
+    if (bus->serial_due) {
+        bus_serial_complete(bus, 0xFF);
+    }
+
+    for (int i = 0; i < GB_SOCKET_LINK_HISTORY; i++) {
+        free(link->snapshots[i].state);
+    }
+    free(link->ours.events);
+    free(link->theirs.events);
+    free(link->used.events);
+    free(link->input.events);
+    free(link->out.events);
+    free(link);
+}
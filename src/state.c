@@ -0,0 +1,460 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/state.h"
+#include "../include/gb.h"
+#include "../include/cpu.h"
+#include "../include/bus.h"
+#include "../include/ppu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t size;          // whole state in bytes
+    uint8_t rom_check[4];   // cart type, header checksum and global checksum of the rom
+} gb_state_header;
+
+// every field outside of memory that affects emulation
+// renderer scratch isn't stored. the sprite buffer and lists are rebuilt from memory when
+// drawing picks up again, the window line counter can't be: loaded mid-frame, the window can
+// draw wrong for the rest of that frame, it's reset at the next one
+typedef struct {
+    // cpu
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t af, bc, de, hl;
+    uint16_t pc, sp;
+    uint32_t count;
+    uint8_t counter;
+    uint8_t ime;
+    uint8_t halted;
+
+    // bus
+    uint8_t dpad_state;
+    uint8_t button_state;
+    uint8_t joypad_select;
+    uint8_t mbc_type;
+    uint8_t rom_bank;
+    uint8_t ram_bank;
+    uint8_t ram_enabled;
+    uint16_t serial_cycles;
+    uint8_t serial_due;
+
+    // ppu
+    uint8_t mode;
+    uint8_t current_ly;
+    uint8_t stat_irq_blocked;
+    uint8_t lcd_enabled;
+    uint16_t dot_counter;
+    uint32_t frame_count;
+} gb_state_machine;
+
+typedef struct {
+    uint16_t start;
+    uint16_t size;
+    uint16_t flag;          // only stored with this header flag, 0 for always
+} gb_state_region;
+
+// echo ram (0xE000-0xFDFF) mirrors wram and is rebuilt on load, 0x0000-0x7FFF is rom
+static const gb_state_region gb_state_regions[] = {
+    { 0x8000, 0x2000, 0 },                  // vram
+    { 0xA000, 0x2000, GB_STATE_CART_RAM },  // cart ram
+    { 0xC000, 0x2000, 0 },                  // wram
+    { 0xFE00, 0x00A0, 0 },                  // oam
+    { 0xFF00, 0x0100, 0 },                  // io registers, hram and ie
+};
+
+#define GB_STATE_REGION_COUNT (sizeof(gb_state_regions) / sizeof(gb_state_regions[0]))
+
+// identifies the rom without hashing it
+void gb_state_rom_check(const gb *gb, uint8_t *check) {
+    const uint8_t *rom = gb->cpu.bus.rom_data;
+    if (rom == NULL) {
+        memset(check, 0, 4);
+        return;
+    }
+    check[0] = rom[0x147];
+    check[1] = rom[0x14D];
+    check[2] = rom[0x14E];
+    check[3] = rom[0x14F];
+}
+
+static uint16_t gb_state_flags(const gb *gb) {
+    const uint8_t *rom = gb->cpu.bus.rom_data;
+    // ram size byte in the cart header
+    if (rom != NULL && rom[0x149] != 0) {
+        return GB_STATE_CART_RAM;
+    }
+    return 0;
+}
+
+static size_t gb_state_size_for(uint16_t flags) {
+    size_t size = sizeof(gb_state_header) + sizeof(gb_state_machine);
+    for (size_t i = 0; i < GB_STATE_REGION_COUNT; i++) {
+        if ((gb_state_regions[i].flag & flags) == gb_state_regions[i].flag) {
+            size += gb_state_regions[i].size;
+        }
+    }
+    return size;
+}
+
+size_t gb_state_size(const gb *gb) {
+    return gb_state_size_for(gb_state_flags(gb));
+}
+
+static void gb_state_get_machine(const gb *gb, gb_state_machine *machine) {
+    const cpu *cpu = &gb->cpu;
+    const bus *bus = &gb->cpu.bus;
+    const ppu *ppu = &gb->ppu;
+
+    memset(machine, 0, sizeof(*machine));
+    machine->a = cpu->registers.a;
+    machine->f = flags_register_to_byte(cpu->registers.f);
+    machine->b = cpu->registers.b;
+    machine->c = cpu->registers.c;
+    machine->d = cpu->registers.d;
+    machine->e = cpu->registers.e;
+    machine->h = cpu->registers.h;
+    machine->l = cpu->registers.l;
+    machine->af = cpu->registers.af;
+    machine->bc = cpu->registers.bc;
+    machine->de = cpu->registers.de;
+    machine->hl = cpu->registers.hl;
+    machine->pc = cpu->registers.pc;
+    machine->sp = cpu->registers.sp;
+    machine->count = cpu->count;
+    machine->counter = cpu->counter;
+    machine->ime = cpu->ime;
+    machine->halted = cpu->halted;
+
+    machine->dpad_state = bus->dpad_state;
+    machine->button_state = bus->button_state;
+    machine->joypad_select = bus->joypad_select;
+    machine->mbc_type = bus->mbc_type;
+    machine->rom_bank = bus->rom_bank;
+    machine->ram_bank = bus->ram_bank;
+    machine->ram_enabled = bus->ram_enabled;
+    machine->serial_cycles = bus->serial_cycles;
+    machine->serial_due = bus->serial_due;
+
+    machine->mode = ppu->mode;
+    machine->current_ly = ppu->current_ly;
+    machine->stat_irq_blocked = ppu->stat_irq_blocked;
+    machine->lcd_enabled = ppu->lcd_enabled;
+    machine->dot_counter = (uint16_t)ppu->dot_counter;
+    machine->frame_count = ppu->frame_count;
+}
+
+size_t gb_save_state(const gb *gb, uint8_t *buffer, size_t size) {
+    const bus *bus = &gb->cpu.bus;
+
+    uint16_t flags = gb_state_flags(gb);
+    size_t total = gb_state_size_for(flags);
+    if (size < total) {
+        return 0;
+    }
+
+    gb_state_header header;
+    header.magic = GB_STATE_MAGIC;
+    header.version = GB_STATE_VERSION;
+    header.flags = flags;
+    header.size = (uint32_t)total;
+    gb_state_rom_check(gb, header.rom_check);
+
+    gb_state_machine machine;
+    gb_state_get_machine(gb, &machine);
+
+    uint8_t *out = buffer;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, &machine, sizeof(machine));
+    out += sizeof(machine);
+
+    for (size_t i = 0; i < GB_STATE_REGION_COUNT; i++) {
+        const gb_state_region *region = &gb_state_regions[i];
+        if ((region->flag & flags) != region->flag) {
+            continue;
+        }
+        memcpy(out, &bus->memory[region->start], region->size);
+        out += region->size;
+    }
+    return total;
+}
+
+// fields used as indices or bank numbers, checked before anything is loaded. the dot counter
+// runs on unchecked while the lcd is off. the mbc type is whatever load_rom picked, a fresh
+// machine (gb_copy) still has 0 so it can't be compared
+static bool gb_state_machine_valid(const gb *gb, const gb_state_machine *machine) {
+    const bus *bus = &gb->cpu.bus;
+    return machine->mode <= 3 &&
+           machine->current_ly < 154 &&
+           (machine->dot_counter < 456 || !machine->lcd_enabled) &&
+           (machine->mbc_type == 0 || machine->mbc_type == 3) &&
+           bus->rom != NULL && ((size_t)machine->rom_bank + 1) * 0x4000 <= bus->rom->size &&
+           machine->ram_bank <= 0x03 &&
+           machine->serial_cycles <= SERIAL_TRANSFER_CYCLES;
+}
+
+int gb_load_state(gb *gb, const uint8_t *buffer, size_t size) {
+    cpu *cpu = &gb->cpu;
+    bus *bus = &gb->cpu.bus;
+    ppu *ppu = &gb->ppu;
+
+    gb_state_header header;
+    if (size < sizeof(header)) {
+        fprintf(stderr, "save state is truncated\n");
+        return -1;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != GB_STATE_MAGIC) {
+        fprintf(stderr, "not a save state\n");
+        return -1;
+    }
+    if (header.version != GB_STATE_VERSION) {
+        fprintf(stderr, "save state version %u, expected %u\n", header.version, GB_STATE_VERSION);
+        return -1;
+    }
+    if (header.size != gb_state_size_for(header.flags) || size < header.size) {
+        fprintf(stderr, "save state is truncated\n");
+        return -1;
+    }
+    uint8_t rom_check[4];
+    gb_state_rom_check(gb, rom_check);
+    if (memcmp(rom_check, header.rom_check, sizeof(rom_check)) != 0) {
+        fprintf(stderr, "save state is for a different rom\n");
+        return -1;
+    }
+
+    const uint8_t *in = buffer + sizeof(header);
+    gb_state_machine machine;
+    memcpy(&machine, in, sizeof(machine));
+    in += sizeof(machine);
+    if (!gb_state_machine_valid(gb, &machine)) {
+        fprintf(stderr, "save state is damaged\n");
+        return -1;
+    }
+
+    cpu->registers.a = machine.a;
+    cpu->registers.f = byte_to_flags_register(machine.f);
+    cpu->registers.b = machine.b;
+    cpu->registers.c = machine.c;
+    cpu->registers.d = machine.d;
+    cpu->registers.e = machine.e;
+    cpu->registers.h = machine.h;
+    cpu->registers.l = machine.l;
+    cpu->registers.af = machine.af;
+    cpu->registers.bc = machine.bc;
+    cpu->registers.de = machine.de;
+    cpu->registers.hl = machine.hl;
+    cpu->registers.pc = machine.pc;
+    cpu->registers.sp = machine.sp;
+    cpu->count = machine.count;
+    cpu->counter = machine.counter;
+    cpu->ime = machine.ime;
+    cpu->halted = machine.halted;
+
+    bus->dpad_state = machine.dpad_state;
+    bus->button_state = machine.button_state;
+    bus->joypad_select = machine.joypad_select;
+    bus->mbc_type = machine.mbc_type;
+    bus->rom_bank = machine.rom_bank;
+    bus->ram_bank = machine.ram_bank;
+    bus->ram_enabled = machine.ram_enabled;
+    bus->serial_cycles = machine.serial_cycles;
+    bus->serial_due = machine.serial_due;
+
+    for (size_t i = 0; i < GB_STATE_REGION_COUNT; i++) {
+        const gb_state_region *region = &gb_state_regions[i];
+        if ((region->flag & header.flags) != region->flag) {
+            continue;
+        }
+        memcpy(&bus->memory[region->start], in, region->size);
+        in += region->size;
+    }
+    memcpy(&bus->memory[0xE000], &bus->memory[0xC000], 0x1E00);
+    memset(bus->page_dirty, 0xFF, sizeof(bus->page_dirty));
+
+    ppu->mode = machine.mode;
+    ppu->current_ly = machine.current_ly;
+    ppu->stat_irq_blocked = machine.stat_irq_blocked;
+    ppu->lcd_enabled = machine.lcd_enabled;
+    ppu->dot_counter = machine.dot_counter;
+    ppu->frame_count = machine.frame_count;
+
+    // memory changed under the renderer, start over from a fresh snapshot
+    ppu_restart_frame(ppu);
+    return 0;
+}
+
+// hashing
+// a multiply and shift per 8 bytes, finished with the murmur3 mixer
+#define GB_HASH_PRIME 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t gb_state_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint64_t gb_state_hash_bytes(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *bytes = data;
+    uint64_t hash = seed;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * GB_HASH_PRIME;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * GB_HASH_PRIME;
+    }
+    return gb_state_mix(hash ^ size);
+}
+
+uint64_t gb_state_hash(gb *gb) {
+    bus *bus = &gb->cpu.bus;
+    uint16_t flags = gb_state_flags(gb);
+    uint64_t hash = GB_STATE_MAGIC;
+
+    // the same memory a state stores, page by page
+    for (size_t i = 0; i < GB_STATE_REGION_COUNT; i++) {
+        const gb_state_region *region = &gb_state_regions[i];
+        if ((region->flag & flags) != region->flag) {
+            continue;
+        }
+        uint32_t end = (uint32_t)region->start + region->size;
+        for (uint32_t address = region->start; address < end; address += 0x100) {
+            uint32_t page = (address - 0x8000) >> 8;
+            bool dirty = bus->page_dirty[page >> 6] & (1ull << (page & 63));
+            // io and hram aren't tracked, see bus_mark_page
+            if (dirty || address >= 0xFF00) {
+                size_t size = end - address < 0x100 ? end - address : 0x100;
+                gb->page_hashes[page] = gb_state_hash_bytes(&bus->memory[address], size, page);
+            }
+            hash = (hash ^ gb->page_hashes[page]) * GB_HASH_PRIME;
+        }
+    }
+    memset(bus->page_dirty, 0, sizeof(bus->page_dirty));
+
+    gb_state_machine machine;
+    gb_state_get_machine(gb, &machine);
+    return gb_state_hash_bytes(&machine, sizeof(machine), hash);
+}
+
+uint64_t gb_frame_hash(const uint8_t *frame) {
+    uint64_t hash = GB_FNV_OFFSET;
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        hash ^= frame[i];
+        hash *= GB_FNV_PRIME;
+    }
+    return hash;
+}
+
+int gb_save_state_file(const gb *gb, const char *path) {
+    size_t size = gb_state_size(gb);
+    uint8_t *buffer = malloc(size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed to allocate memory for save state\n");
+        return -1;
+    }
+    gb_save_state(gb, buffer, size);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open save state file: %s\n", path);
+        free(buffer);
+        return -1;
+    }
+    size_t written = fwrite(buffer, 1, size, file);
+    int closed = fclose(file);
+    free(buffer);
+    if (written != size || closed != 0) {
+        fprintf(stderr, "Failed to write save state: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int gb_state_map_open(gb_state_map *map, const char *path) {
+    map->data = NULL;
+    map->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open save state file: %s\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        fprintf(stderr, "save state is truncated\n");
+        close(fd);
+        return -1;
+    }
+
+    // private and read only: pages come straight from the page cache and stay shared
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map save state file: %s\n", path);
+        return -1;
+    }
+    map->data = data;
+    map->size = st.st_size;
+    return 0;
+}
+
+void gb_state_map_close(gb_state_map *map) {
+    if (map->data != NULL) {
+        munmap((void *)map->data, map->size);
+        map->data = NULL;
+        map->size = 0;
+    }
+}
+
+int gb_load_state_file(gb *gb, const char *path) {
+    gb_state_map map;
+    if (gb_state_map_open(&map, path) != 0) {
+        return -1;
+    }
+    int result = gb_load_state(gb, map.data, map.size);
+    gb_state_map_close(&map);
+    return result;
+}
+
+uint32_t gb_run_frame_ahead(gb *gb, uint32_t ahead, uint8_t *state, size_t size) {
+    bool skip = gb->ppu.skip_frame;
+    if (ahead == 0 || skip) {
+        return gb_run_frame(gb);
+    }
+
+    // the real frame is never shown, the last one run ahead stands in for it
+    gb->ppu.skip_frame = true;
+    uint32_t cycles = gb_run_frame(gb);
+    if (gb_save_state(gb, state, size) == 0) {
+        gb->ppu.skip_frame = skip;
+        return cycles;
+    }
+
+    // queued input is applied ahead too, but stays queued for the real frames
+    gb->input.ahead = true;
+    for (uint32_t i = 0; i < ahead; i++) {
+        gb->ppu.skip_frame = i + 1 < ahead;
+        gb_run_frame(gb);
+    }
+    gb_load_state(gb, state, size);
+    gb->input.next = gb->input.tail;
+    gb->input.ahead = false;
+    __atomic_store_n(&gb->input.clock, gb->cpu.count, __ATOMIC_RELEASE);
+    gb->ppu.skip_frame = skip;
+    return cycles;
+}
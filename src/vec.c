@@ -0,0 +1,292 @@
+#include "../include/vec.h"
+#include "../include/gb.h"
+#include "../include/bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the renderer wrote the final frame into the output, nothing to copy
+static void gb_vec_end_frame(void *user, uint8_t *buffer, void *pixels) {
+    (void)buffer;
+    (void)pixels;
+    ((gb_vec_env *)user)->frame_written = true;
+}
+
+// start an env over on a freshly initialised machine, from the start state or a copy of boot.
+// either way the rom is boot's, it's only read from disk once
+static int gb_vec_load(gb_vec *vec, int index) {
+    gb *gb = vec->envs[index].gb;
+    if (vec->start_state.data != NULL) {
+        bus_share_rom(&gb->cpu.bus, vec->boot->cpu.bus.rom);
+        return gb_load_state(gb, vec->start_state.data, vec->start_state.size);
+    }
+    return gb_copy(gb, vec->boot);
+}
+
+// one env for one step
+// only the last frame is drawn, and it's drawn straight into the caller's array:
+// a 1 byte per pixel sink with an identity palette gives the shades the observation wants
+static void gb_vec_step_env(gb_vec *vec, int index) {
+    gb_vec_env *env = &vec->envs[index];
+    gb *gb = env->gb;
+    uint8_t *frame = &vec->frames[index * gb_vec_frame_size(vec)];
+
+    gb_set_joypad(gb, vec->actions[index]);
+
+    ppu_output_sink sink = {0};
+    sink.user = env;
+    sink.end_frame = gb_vec_end_frame;
+    sink.bytes_per_pixel = 1;
+    for (int i = 0; i < 4; i++) {
+        sink.palette[i] = i;
+    }
+    env->frame_written = false;
+
+    for (uint32_t i = 0; i < vec->frames_per_step; i++) {
+        bool last = i + 1 == vec->frames_per_step;
+        gb->ppu.skip_frame = !last;
+        if (last) {
+            if (vec->observation_width > 0) {
+                ppu_observation observation = {0};
+                observation.pixels = frame;
+                observation.width = vec->observation_width;
+                observation.height = vec->observation_height;
+                observation.box_filter = vec->observation_box_filter;
+                ppu_set_observation(&gb->ppu, &observation);
+            } else {
+                sink.pixels = frame;
+            }
+            ppu_set_output_sink(&gb->ppu, &sink);
+        }
+        gb_run_frame(gb);
+    }
+    ppu_set_output_sink(&gb->ppu, NULL);
+
+    // lcd was off, show what's left on screen
+    if (vec->observation_width > 0) {
+        if (!env->frame_written) {
+            ppu_observe_screen(&gb->ppu);
+        }
+        ppu_set_observation(&gb->ppu, NULL);
+    } else if (!env->frame_written) {
+        memcpy(frame, gb->ppu.screen_buffer, GB_VEC_FRAME_SIZE);
+    }
+
+    if (vec->ram != NULL) {
+        uint8_t *ram = &vec->ram[(size_t)index * vec->ram_count];
+        for (int i = 0; i < vec->ram_count; i++) {
+            ram[i] = bus_read8(&gb->cpu.bus, vec->ram_addresses[i]);
+        }
+    }
+}
+
+// take envs until there are none left in this step
+static void gb_vec_run(gb_vec *vec) {
+    for (;;) {
+        int index = __atomic_fetch_add(&vec->next_env, 1, __ATOMIC_RELAXED);
+        if (index >= vec->count) {
+            return;
+        }
+        gb_vec_step_env(vec, index);
+    }
+}
+
+static void *gb_vec_worker(void *arg) {
+    gb_vec *vec = arg;
+    uint32_t seen = 0;
+
+    pthread_mutex_lock(&vec->lock);
+    for (;;) {
+        while (vec->generation == seen && !vec->stopping) {
+            pthread_cond_wait(&vec->start, &vec->lock);
+        }
+        if (vec->stopping) {
+            break;
+        }
+        seen = vec->generation;
+        pthread_mutex_unlock(&vec->lock);
+
+        gb_vec_run(vec);
+
+        pthread_mutex_lock(&vec->lock);
+        if (--vec->busy == 0) {
+            pthread_cond_signal(&vec->finished);
+        }
+    }
+    pthread_mutex_unlock(&vec->lock);
+    return NULL;
+}
+
+gb_vec *gb_vec_create(const char *rom_path, int count, uint32_t frames_per_step, int threads) {
+    gb_vec *vec = calloc(1, sizeof(gb_vec));
+    if (vec == NULL) {
+        fprintf(stderr, "Failed to allocate memory for gb_vec\n");
+        return NULL;
+    }
+    vec->count = count;
+    vec->rom_path = rom_path;
+    vec->frames_per_step = frames_per_step > 0 ? frames_per_step : 1;
+
+    vec->envs = calloc(count, sizeof(gb_vec_env));
+    if (vec->envs == NULL) {
+        fprintf(stderr, "Failed to allocate memory for gb_vec envs\n");
+        free(vec);
+        return NULL;
+    }
+    vec->boot = gb_create();
+    if (vec->boot == NULL || gb_load_rom(vec->boot, rom_path) != 0) {
+        gb_vec_destroy(vec);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        vec->envs[i].gb = gb_create();
+        if (vec->envs[i].gb == NULL || gb_vec_load(vec, i) != 0) {
+            gb_vec_destroy(vec);
+            return NULL;
+        }
+    }
+
+    // the caller runs envs too, so one thread fewer than cpus
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    }
+    if (threads > count - 1) {
+        threads = count - 1;
+    }
+
+    pthread_mutex_init(&vec->lock, NULL);
+    pthread_cond_init(&vec->start, NULL);
+    pthread_cond_init(&vec->finished, NULL);
+    vec->workers = malloc((threads > 0 ? threads : 1) * sizeof(pthread_t));
+    if (vec->workers == NULL) {
+        fprintf(stderr, "Failed to allocate memory for gb_vec workers\n");
+        exit(1);
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&vec->workers[i], NULL, gb_vec_worker, vec) != 0) {
+            // fewer workers is only slower
+            fprintf(stderr, "failed to start gb_vec worker\n");
+            break;
+        }
+        vec->threads++;
+    }
+    return vec;
+}
+
+void gb_vec_destroy(gb_vec *vec) {
+    if (vec == NULL) {
+        return;
+    }
+    if (vec->workers != NULL) {
+        pthread_mutex_lock(&vec->lock);
+        vec->stopping = true;
+        pthread_cond_broadcast(&vec->start);
+        pthread_mutex_unlock(&vec->lock);
+        for (int i = 0; i < vec->threads; i++) {
+            pthread_join(vec->workers[i], NULL);
+        }
+        free(vec->workers);
+        pthread_mutex_destroy(&vec->lock);
+        pthread_cond_destroy(&vec->start);
+        pthread_cond_destroy(&vec->finished);
+    }
+    for (int i = 0; i < vec->count; i++) {
+        gb_destroy(vec->envs[i].gb);
+    }
+    gb_destroy(vec->boot);
+    free(vec->envs);
+    free(vec->ram_addresses);
+    gb_state_map_close(&vec->start_state);
+    free(vec);
+}
+
+int gb_vec_set_ram_observation(gb_vec *vec, const uint16_t *addresses, int count) {
+    uint16_t *copy = NULL;
+    if (count > 0) {
+        copy = malloc(count * sizeof(uint16_t));
+        if (copy == NULL) {
+            fprintf(stderr, "Failed to allocate memory for ram observation\n");
+            return -1;
+        }
+        memcpy(copy, addresses, count * sizeof(uint16_t));
+    }
+    free(vec->ram_addresses);
+    vec->ram_addresses = copy;
+    vec->ram_count = count > 0 ? count : 0;
+    return 0;
+}
+
+int gb_vec_set_observation(gb_vec *vec, uint8_t width, uint8_t height, bool box_filter) {
+    if ((width == 0) != (height == 0) || width > SCREEN_WIDTH || height > SCREEN_HEIGHT) {
+        fprintf(stderr, "observation size %dx%d out of range\n", width, height);
+        return -1;
+    }
+    vec->observation_width = width;
+    vec->observation_height = height;
+    vec->observation_box_filter = box_filter;
+    return 0;
+}
+
+size_t gb_vec_frame_size(const gb_vec *vec) {
+    if (vec->observation_width > 0) {
+        return (size_t)vec->observation_width * vec->observation_height;
+    }
+    return GB_VEC_FRAME_SIZE;
+}
+
+int gb_vec_set_start_state(gb_vec *vec, const char *path) {
+    gb_state_map map;
+    if (gb_state_map_open(&map, path) != 0) {
+        return -1;
+    }
+    // try it on a scratch machine first, so a bad state leaves every env where it was. it
+    // loads the same into each of them after that
+    gb *scratch = gb_create();
+    if (scratch != NULL) {
+        bus_share_rom(&scratch->cpu.bus, vec->boot->cpu.bus.rom);
+    }
+    if (scratch == NULL || gb_load_state(scratch, map.data, map.size) != 0) {
+        gb_destroy(scratch);
+        gb_state_map_close(&map);
+        return -1;
+    }
+    gb_destroy(scratch);
+    for (int i = 0; i < vec->count; i++) {
+        gb_load_state(vec->envs[i].gb, map.data, map.size);
+    }
+    gb_state_map_close(&vec->start_state);
+    vec->start_state = map;
+    return 0;
+}
+
+int gb_vec_reset(gb_vec *vec, int env) {
+    if (env < 0 || env >= vec->count) {
+        return -1;
+    }
+    gb_free(vec->envs[env].gb);
+    gb_init(vec->envs[env].gb);
+    return gb_vec_load(vec, env);
+}
+
+void gb_vec_step(gb_vec *vec, const uint8_t *actions, uint8_t *frames, uint8_t *ram) {
+    vec->actions = actions;
+    vec->frames = frames;
+    vec->ram = ram;
+    vec->next_env = 0;
+
+    // wake the workers and help out
+    pthread_mutex_lock(&vec->lock);
+    vec->busy = vec->threads;
+    vec->generation++;
+    pthread_cond_broadcast(&vec->start);
+    pthread_mutex_unlock(&vec->lock);
+
+    gb_vec_run(vec);
+
+    pthread_mutex_lock(&vec->lock);
+    while (vec->busy > 0) {
+        pthread_cond_wait(&vec->finished, &vec->lock);
+    }
+    pthread_mutex_unlock(&vec->lock);
+}
@@ -0,0 +1,61 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// damaged movie headers have to be turned away before their sizes are used, not hang or
+// allocate whatever the file says
+
+// the header as movie.c writes it
+static size_t write_header(uint8_t *out, uint32_t start_state_size, uint64_t events_size) {
+    uint32_t magic = GB_MOVIE_MAGIC;
+    uint16_t version = GB_MOVIE_VERSION;
+    uint64_t length = 1000;
+    memset(out, 0, 32);
+    memcpy(&out[0], &magic, 4);
+    memcpy(&out[4], &version, 2);
+    memcpy(&out[12], &start_state_size, 4);
+    memcpy(&out[16], &length, 8);
+    memcpy(&out[24], &events_size, 8);
+    return 32;
+}
+
+// movie file of a header and extra zero bytes, loaded back. 1 if it loads, 0 if not
+static int load(uint32_t start_state_size, uint64_t events_size, size_t extra) {
+    uint8_t data[64] = {0};
+    size_t size = write_header(data, start_state_size, events_size) + extra;
+
+    char path[] = "/tmp/gb_movie_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t written = write(fd, data, size);
+    close(fd);
+    if (written != (ssize_t)size) {
+        unlink(path);
+        return -1;
+    }
+    gb_movie *movie = gb_movie_load(path);
+    unlink(path);
+    gb_movie_destroy(movie);
+    return movie != NULL;
+}
+
+int main(void) {
+    int result = 0;
+    if (load(0, 8, 8) != 1) {
+        fprintf(stderr, "movie_load: a good movie didn't load\n");
+        result = 1;
+    }
+    if (load(0, (1ULL << 63) + 5, 8) != 0 || load(0, UINT64_MAX, 8) != 0 ||
+        load(0xFFFFFFFF, 8, 8) != 0 || load(4, 8, 8) != 0 || load(0, 9, 8) != 0) {
+        fprintf(stderr, "movie_load: a damaged movie loaded\n");
+        result = 1;
+    }
+    printf("movie_load: %s\n", result == 0 ? "ok" : "FAILED");
+    return result;
+}
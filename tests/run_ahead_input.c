@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/gb.h"
+#include "../include/state.h"
+#include "../include/movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// input pushed through the queue while run-ahead is on has to reach the real machine, and a
+// movie recorded that way has to play back to the same state
+
+// di, then forever: select the dpad, read it back into 0xC000
+static const uint8_t test_program[] = {
+    0xF3,               // di
+    0x3E, 0x20,         // ld a, 0x20
+    0xE0, 0x00,         // ldh (0x00), a
+    0xF0, 0x00,         // ldh a, (0x00)
+    0xEA, 0x00, 0xC0,   // ld (0xC000), a
+    0x18, 0xF5,         // jr back to ld a, 0x20
+};
+
+static int write_rom(char *path) {
+    static uint8_t rom[0x8000];
+    memset(rom, 0, sizeof(rom));
+    const uint8_t entry[] = { 0x00, 0xC3, 0x50, 0x01 };   // nop, jp 0x0150
+    memcpy(&rom[0x100], entry, sizeof(entry));
+    memcpy(&rom[0x134], "RUNAHEAD", 8);
+    memcpy(&rom[0x150], test_program, sizeof(test_program));
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t written = write(fd, rom, sizeof(rom));
+    close(fd);
+    return written == (ssize_t)sizeof(rom) ? 0 : -1;
+}
+
+static int applied;
+
+static void count_applied(void *user, gb *gb) {
+    (void)user;
+    (void)gb;
+    applied++;
+}
+
+static int run_ahead_input(const char *rom_path, uint32_t ahead) {
+    gb *gb = gb_create();
+    if (gb == NULL || gb_load_rom(gb, rom_path) != 0) {
+        gb_destroy(gb);
+        return -1;
+    }
+    size_t size = gb_state_size(gb);
+    uint8_t *state = malloc(size);
+    if (state == NULL) {
+        gb_destroy(gb);
+        return -1;
+    }
+    applied = 0;
+    gb->input.applied = count_applied;
+
+    int failed = 0;
+    for (int frame = 0; frame < 5; frame++) {
+        gb_run_frame_ahead(gb, ahead, state, size);
+    }
+    if (gb_input_clock(gb) != gb->cpu.count) {
+        printf("ahead %u: input clock %u, cpu at %u\n", ahead, gb_input_clock(gb), gb->cpu.count);
+        failed = 1;
+    }
+
+    gb_input_push(gb, gb_input_clock(gb), GB_BUTTON_RIGHT);
+    for (int frame = 0; frame < 5; frame++) {
+        gb_run_frame_ahead(gb, ahead, state, size);
+    }
+
+    uint8_t dpad = gb->cpu.bus.memory[0xC000] & 0x0F;
+    if (dpad != 0x0E || gb->input.tail != gb->input.head || applied != 1 ||
+        gb_input_clock(gb) != gb->cpu.count) {
+        printf("ahead %u: dpad %02x, queue %u/%u, applied %d times, clock %u, cpu at %u\n", ahead, dpad,
+               gb->input.tail, gb->input.head, applied, gb_input_clock(gb), gb->cpu.count);
+        failed = 1;
+    }
+
+    free(state);
+    gb_destroy(gb);
+    return failed ? -1 : 0;
+}
+
+static void record_applied(void *user, gb *gb) {
+    gb_movie_sample((gb_movie *)user, gb);
+}
+
+// record like the frontend does with --record --runahead, then play it back without
+static int run_ahead_movie(const char *rom_path, uint32_t ahead) {
+    gb *gb = gb_create();
+    if (gb == NULL || gb_load_rom(gb, rom_path) != 0) {
+        gb_destroy(gb);
+        return -1;
+    }
+    size_t size = gb_state_size(gb);
+    uint8_t *state = malloc(size);
+    gb_movie *movie = gb_movie_record(gb, false);
+    if (state == NULL || movie == NULL) {
+        free(state);
+        gb_movie_destroy(movie);
+        gb_destroy(gb);
+        return -1;
+    }
+    gb->input.applied = record_applied;
+    gb->input.user = movie;
+
+    uint32_t start = gb->cpu.count;
+    for (int frame = 0; frame < 12; frame++) {
+        if (frame == 3) {
+            gb_input_push(gb, gb_input_clock(gb), GB_BUTTON_RIGHT);
+        } else if (frame == 7) {
+            // due after the real frame, so the frames run ahead see it first
+            gb_input_push(gb, gb_input_clock(gb) + GB_CYCLES_PER_FRAME + 1000, GB_BUTTON_RIGHT | GB_BUTTON_A);
+        }
+        gb_movie_sample(movie, gb);
+        gb_run_frame_ahead(gb, ahead, state, size);
+    }
+    gb_movie_stop(movie, gb);
+    uint64_t recorded = gb_state_hash(gb);
+    uint64_t length = gb->cpu.count - start;
+
+    int failed = 0;
+    if (movie->length != length) {
+        printf("ahead %u: movie is %llu cycles long, ran %llu\n", ahead, (unsigned long long)movie->length,
+               (unsigned long long)length);
+        failed = 1;
+    }
+
+    gb_destroy(gb);
+    gb = gb_create();
+    if (gb == NULL || gb_load_rom(gb, rom_path) != 0 || gb_movie_play(movie, gb) != 0) {
+        failed = 1;
+    } else {
+        while (!gb_movie_finished(movie)) {
+            gb_movie_run_frame(movie, gb);
+        }
+        if (gb_state_hash(gb) != recorded) {
+            printf("ahead %u: movie plays back to a different state\n", ahead);
+            failed = 1;
+        }
+    }
+
+    free(state);
+    gb_movie_destroy(movie);
+    gb_destroy(gb);
+    return failed ? -1 : 0;
+}
+
+int main(void) {
+    char rom_path[] = "/tmp/gb_run_ahead_XXXXXX";
+    if (write_rom(rom_path) != 0) {
+        fprintf(stderr, "failed to write test rom\n");
+        return 1;
+    }
+
+    int result = 0;
+    for (uint32_t ahead = 0; ahead <= 3; ahead++) {
+        if (run_ahead_input(rom_path, ahead) != 0 || run_ahead_movie(rom_path, ahead) != 0) {
+            result = 1;
+        }
+    }
+    unlink(rom_path);
+    printf("run_ahead_input: %s\n", result == 0 ? "ok" : "FAILED");
+    return result;
+}